@@ -0,0 +1,389 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <string>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+
+#include "Columnar.h"
+#include "MappedFile.h"
+
+using namespace std;
+
+namespace Jinja2CppLight {
+
+namespace {
+
+const char MAGIC[8] = { 'J', '2', 'C', 'L', 'C', 'O', 'L', 'S' };
+const uint32_t VERSION = 1;
+const size_t HEADER_SIZE = 40;
+const size_t DESCRIPTOR_SIZE = 32;
+
+uint32_t readUint32( const char *at ) {
+    uint32_t value;
+    memcpy( &value, at, sizeof( value ) );
+    return value;
+}
+uint64_t readUint64( const char *at ) {
+    uint64_t value;
+    memcpy( &value, at, sizeof( value ) );
+    return value;
+}
+size_t aligned( size_t offset ) {
+    return ( offset + 7 ) / 8 * 8;
+}
+
+}
+
+class ColumnarColumn {
+public:
+    std::string name;
+    ColumnarTable::ColumnType type;
+    const char *values; // in the mapping
+};
+
+// the mapped file, and where its columns are.  Shared by every Value that
+// reads from it
+class ColumnarData {
+public:
+    std::shared_ptr< const MappedFile > file;
+    size_t numRows;
+    std::vector< ColumnarColumn > columns;
+    const char *strings;
+    size_t stringsLength;
+
+    // the key's hint remembers the column, so a loop looking up the same key
+    // in every row compares one name per row
+    int findColumn( const MapKey &key ) const {
+        size_t hint = key.hint.load( std::memory_order_relaxed );
+        if( hint < columns.size() && columns[hint].name == key.name ) {
+            return (int)hint;
+        }
+        for( size_t i = 0; i < columns.size(); i++ ) {
+            if( columns[i].name == key.name ) {
+                key.hint.store( i, std::memory_order_relaxed );
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+    const Value *get( size_t row, int column, Value &scratch ) const {
+        const ColumnarColumn &info = columns[column];
+        switch( info.type ) {
+            case ColumnarTable::INT64:
+                scratch.setInt( (int64_t)readUint64( info.values + row * 8 ) );
+                break;
+            case ColumnarTable::FLOAT64: {
+                double value;
+                memcpy( &value, info.values + row * 8, sizeof( value ) );
+                scratch.setFloat( value );
+                break;
+            }
+            default: {
+                // borrowed: whoever holds this data keeps the mapping alive
+                uint64_t start = readUint64( info.values + row * 8 );
+                uint64_t end = readUint64( info.values + ( row + 1 ) * 8 );
+                if( start > end || end > stringsLength ) {
+                    throw render_error( "column " + info.name + ": string out of range" );
+                }
+                scratch = Value::borrow( strings + start, end - start );
+            }
+        }
+        return &scratch;
+    }
+};
+
+namespace {
+
+class ColumnarRow : public Map {
+public:
+    std::shared_ptr< const ColumnarData > data;
+    size_t row;
+
+    ColumnarRow( const std::shared_ptr< const ColumnarData > &data, size_t row ) :
+        data( data ),
+        row( row ) {
+    }
+    size_t size() const {
+        return data->columns.size();
+    }
+    const Value *get( const MapKey &key, Value &scratch ) const {
+        int column = data->findColumn( key );
+        return column < 0 ? 0 : data->get( row, column, scratch );
+    }
+    void render( Output &output ) const {
+        Value scratch;
+        output.write( "{", 1 );
+        for( size_t i = 0; i < data->columns.size(); i++ ) {
+            if( i > 0 ) {
+                output.write( ", ", 2 );
+            }
+            output.write( data->columns[i].name );
+            output.write( ": ", 2 );
+            data->get( row, (int)i, scratch )->render( output );
+        }
+        output.write( "}", 1 );
+    }
+};
+
+// rows in order, for a for loop: one ColumnarRow, moved along in place, so
+// nothing is allocated per row
+class ColumnarRowIterator : public Iterator {
+public:
+    ColumnarRow row;
+    size_t nextRow;
+
+    ColumnarRowIterator( const std::shared_ptr< const ColumnarData > &data ) :
+        row( data, 0 ),
+        nextRow( 0 ) {
+    }
+    const Value *next( Value &scratch ) {
+        if( nextRow >= row.data->numRows ) {
+            return 0;
+        }
+        row.row = nextRow++;
+        scratch = Value( std::shared_ptr< const Map >( std::shared_ptr< const Map >(), &row ) );
+        return &scratch;
+    }
+};
+
+class ColumnarRows : public Sequence {
+public:
+    std::shared_ptr< const ColumnarData > data;
+
+    ColumnarRows( const std::shared_ptr< const ColumnarData > &data ) :
+        data( data ) {
+    }
+    size_t size() const {
+        return data->numRows;
+    }
+    // for indexing, eg records[5]; loops use iterate()
+    const Value *at( size_t index, Value &scratch ) const {
+        scratch = Value( std::shared_ptr< const Map >( std::make_shared< ColumnarRow >( data, index ) ) );
+        return &scratch;
+    }
+    std::unique_ptr< Iterator > iterate() const {
+        return std::unique_ptr< Iterator >( new ColumnarRowIterator( data ) );
+    }
+};
+
+// a numeric column, viewed in place
+template< typename T >
+class ColumnarNumbers : public SequenceView< T > {
+public:
+    std::shared_ptr< const ColumnarData > data;
+
+    ColumnarNumbers( const std::shared_ptr< const ColumnarData > &data, const T *values ) :
+        SequenceView< T >( values, data->numRows ),
+        data( data ) {
+    }
+};
+
+class ColumnarStrings : public Sequence {
+public:
+    std::shared_ptr< const ColumnarData > data;
+    int column;
+
+    ColumnarStrings( const std::shared_ptr< const ColumnarData > &data, int column ) :
+        data( data ),
+        column( column ) {
+    }
+    size_t size() const {
+        return data->numRows;
+    }
+    const Value *at( size_t index, Value &scratch ) const {
+        return data->get( index, column, scratch );
+    }
+};
+
+}
+
+ColumnarTable::ColumnarTable( const std::string &filepath ) {
+    std::shared_ptr< ColumnarData > newData = std::make_shared< ColumnarData >();
+    std::shared_ptr< const MappedFile > file = std::make_shared< const MappedFile >( filepath );
+    newData->file = file;
+    const char *base = file->data;
+    size_t length = file->length;
+    if( length < HEADER_SIZE || memcmp( base, MAGIC, sizeof( MAGIC ) ) != 0 ) {
+        throw runtime_error( filepath + " is not a columnar file" );
+    }
+    if( readUint32( base + 8 ) != VERSION ) {
+        throw runtime_error( filepath + ": unsupported columnar version" );
+    }
+    size_t numColumns = readUint32( base + 12 );
+    newData->numRows = readUint64( base + 16 );
+    uint64_t stringsOffset = readUint64( base + 24 );
+    uint64_t stringsLength = readUint64( base + 32 );
+    if( stringsOffset > length || stringsLength > length - stringsOffset
+            || numColumns > ( length - HEADER_SIZE ) / DESCRIPTOR_SIZE ) {
+        throw runtime_error( filepath + ": columnar file is truncated" );
+    }
+    newData->strings = base + stringsOffset;
+    newData->stringsLength = stringsLength;
+    for( size_t i = 0; i < numColumns; i++ ) {
+        const char *descriptor = base + HEADER_SIZE + i * DESCRIPTOR_SIZE;
+        ColumnarColumn column;
+        column.type = (ColumnType)readUint32( descriptor );
+        uint64_t nameLength = readUint32( descriptor + 4 );
+        uint64_t nameOffset = readUint64( descriptor + 8 );
+        uint64_t dataOffset = readUint64( descriptor + 16 );
+        if( column.type != INT64 && column.type != FLOAT64 && column.type != STRING ) {
+            throw runtime_error( filepath + ": unknown column type" );
+        }
+        if( nameOffset > stringsLength || nameLength > stringsLength - nameOffset ) {
+            throw runtime_error( filepath + ": columnar file is truncated" );
+        }
+        column.name.assign( newData->strings + nameOffset, nameLength );
+        uint64_t dataLength = ( newData->numRows + ( column.type == STRING ? 1 : 0 ) ) * 8;
+        if( dataOffset % 8 != 0 || dataOffset > length || newData->numRows > length
+                || dataLength > length - dataOffset ) {
+            throw runtime_error( filepath + ": columnar file is truncated" );
+        }
+        column.values = base + dataOffset;
+        newData->columns.push_back( column );
+    }
+    data = newData;
+}
+size_t ColumnarTable::numRows() const {
+    return data->numRows;
+}
+int ColumnarTable::numColumns() const {
+    return (int)data->columns.size();
+}
+const std::string &ColumnarTable::columnName( int column ) const {
+    return data->columns[column].name;
+}
+ColumnarTable::ColumnType ColumnarTable::columnType( int column ) const {
+    return data->columns[column].type;
+}
+int ColumnarTable::findColumn( const std::string &name ) const {
+    return data->findColumn( MapKey( name ) );
+}
+Value ColumnarTable::rows() const {
+    return Value( std::shared_ptr< const Sequence >( std::make_shared< ColumnarRows >( data ) ) );
+}
+Value ColumnarTable::column( const std::string &name ) const {
+    int column = findColumn( name );
+    if( column < 0 ) {
+        throw runtime_error( "no column " + name );
+    }
+    const ColumnarColumn &info = data->columns[column];
+    switch( info.type ) {
+        case INT64:
+            return Value( std::shared_ptr< const Sequence >( std::make_shared< ColumnarNumbers< int64_t > >(
+                data, (const int64_t *)info.values ) ) );
+        case FLOAT64:
+            return Value( std::shared_ptr< const Sequence >( std::make_shared< ColumnarNumbers< double > >(
+                data, (const double *)info.values ) ) );
+        default:
+            return Value( std::shared_ptr< const Sequence >( std::make_shared< ColumnarStrings >( data, column ) ) );
+    }
+}
+
+size_t ColumnarWriter::PendingColumn::size() const {
+    return type == ColumnarTable::INT64 ? ints.size() : type == ColumnarTable::FLOAT64 ? floats.size() : strings.size();
+}
+ColumnarWriter &ColumnarWriter::addColumn( const std::string &name, std::vector< int64_t > values ) {
+    PendingColumn column;
+    column.name = name;
+    column.type = ColumnarTable::INT64;
+    column.ints = std::move( values );
+    columns.push_back( std::move( column ) );
+    return *this;
+}
+ColumnarWriter &ColumnarWriter::addColumn( const std::string &name, std::vector< double > values ) {
+    PendingColumn column;
+    column.name = name;
+    column.type = ColumnarTable::FLOAT64;
+    column.floats = std::move( values );
+    columns.push_back( std::move( column ) );
+    return *this;
+}
+ColumnarWriter &ColumnarWriter::addColumn( const std::string &name, std::vector< std::string > values ) {
+    PendingColumn column;
+    column.name = name;
+    column.type = ColumnarTable::STRING;
+    column.strings = std::move( values );
+    columns.push_back( std::move( column ) );
+    return *this;
+}
+void ColumnarWriter::write( const std::string &filepath ) const {
+    size_t numRows = columns.empty() ? 0 : columns[0].size();
+    for( size_t i = 0; i < columns.size(); i++ ) {
+        if( columns[i].size() != numRows ) {
+            throw runtime_error( "column " + columns[i].name + " has a different number of rows" );
+        }
+    }
+    // the string heap holds the names, then every string column's values
+    std::string heap;
+    std::vector< uint64_t > nameOffsets;
+    for( size_t i = 0; i < columns.size(); i++ ) {
+        nameOffsets.push_back( heap.size() );
+        heap += columns[i].name;
+    }
+    std::vector< std::vector< uint64_t > > stringOffsets( columns.size() );
+    for( size_t i = 0; i < columns.size(); i++ ) {
+        if( columns[i].type != ColumnarTable::STRING ) {
+            continue;
+        }
+        for( size_t row = 0; row < numRows; row++ ) {
+            stringOffsets[i].push_back( heap.size() );
+            heap += columns[i].strings[row];
+        }
+        stringOffsets[i].push_back( heap.size() );
+    }
+
+    std::string file( HEADER_SIZE + columns.size() * DESCRIPTOR_SIZE, '\0' );
+    std::vector< uint64_t > dataOffsets;
+    for( size_t i = 0; i < columns.size(); i++ ) {
+        file.resize( aligned( file.size() ), '\0' );
+        dataOffsets.push_back( file.size() );
+        const PendingColumn &column = columns[i];
+        if( column.type == ColumnarTable::INT64 ) {
+            file.append( (const char *)column.ints.data(), numRows * 8 );
+        } else if( column.type == ColumnarTable::FLOAT64 ) {
+            file.append( (const char *)column.floats.data(), numRows * 8 );
+        } else {
+            file.append( (const char *)stringOffsets[i].data(), ( numRows + 1 ) * 8 );
+        }
+    }
+    file.resize( aligned( file.size() ), '\0' );
+    uint64_t stringsOffset = file.size();
+    file += heap;
+
+    uint32_t version = VERSION;
+    uint32_t numColumns = (uint32_t)columns.size();
+    uint64_t rows = numRows;
+    uint64_t stringsLength = heap.size();
+    memcpy( &file[0], MAGIC, sizeof( MAGIC ) );
+    memcpy( &file[8], &version, 4 );
+    memcpy( &file[12], &numColumns, 4 );
+    memcpy( &file[16], &rows, 8 );
+    memcpy( &file[24], &stringsOffset, 8 );
+    memcpy( &file[32], &stringsLength, 8 );
+    for( size_t i = 0; i < columns.size(); i++ ) {
+        char *descriptor = &file[HEADER_SIZE + i * DESCRIPTOR_SIZE];
+        uint32_t type = columns[i].type;
+        uint32_t nameLength = (uint32_t)columns[i].name.size();
+        memcpy( descriptor, &type, 4 );
+        memcpy( descriptor + 4, &nameLength, 4 );
+        memcpy( descriptor + 8, &nameOffsets[i], 8 );
+        memcpy( descriptor + 16, &dataOffsets[i], 8 );
+    }
+
+    FILE *out = fopen( filepath.c_str(), "wb" );
+    if( out == 0 ) {
+        throw runtime_error( "couldnt open " + filepath + " for writing" );
+    }
+    size_t written = fwrite( file.data(), 1, file.size(), out );
+    if( fclose( out ) != 0 || written != file.size() ) {
+        throw runtime_error( "error writing " + filepath );
+    }
+}
+
+}
+
@@ -0,0 +1,94 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// tables of records too big to build as TupleValues, stored in a binary file
+// that templates read in place:
+//
+//     ColumnarTable table( "records.cols" );
+//     mytemplate.setValue( "records", table.rows() );
+//     // {% for r in records %}{{ r.name }}: {{ r.price }}{% endfor %}
+//
+// the file is mapped read-only and shared, so several processes rendering
+// from the same file share one copy of it in the page cache.  Nothing is
+// parsed on open apart from the header: rows and values are read from the
+// mapping as the template reaches them
+//
+// layout, all integers in native byte order, every section 8-byte aligned:
+//     header, 40 bytes:
+//         char[8] magic "J2CLCOLS"
+//         uint32 version (1), uint32 numColumns
+//         uint64 numRows
+//         uint64 stringsOffset, uint64 stringsLength: the string heap
+//     one column descriptor per column, 32 bytes each:
+//         uint32 type (ColumnarTable::ColumnType), uint32 nameLength
+//         uint64 nameOffset: into the string heap
+//         uint64 dataOffset: from the start of the file
+//         uint64 reserved, 0
+//     column data: numRows int64s or doubles; or for strings numRows + 1
+//         uint64 offsets into the string heap, row i being
+//         [ offsets[i], offsets[i + 1] )
+//     the string heap
+// ColumnarWriter writes this format
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "Value.h"
+
+namespace Jinja2CppLight {
+
+class ColumnarData;
+
+class ColumnarTable {
+public:
+    enum ColumnType { INT64 = 1, FLOAT64 = 2, STRING = 3 };
+
+    // throws std::runtime_error if filepath isn't a columnar file
+    ColumnarTable( const std::string &filepath );
+
+    size_t numRows() const;
+    int numColumns() const;
+    const std::string &columnName( int column ) const;
+    ColumnType columnType( int column ) const;
+    // -1 if there is no such column
+    int findColumn( const std::string &name ) const;
+
+    // one Map per row, with a key per column.  The Values keep the file
+    // mapped for as long as they exist
+    Value rows() const;
+    // one column's values, as a sequence; numbers render in batches
+    Value column( const std::string &name ) const;
+private:
+    std::shared_ptr< const ColumnarData > data;
+};
+
+// collects whole columns in memory, then writes them out in the format above
+class ColumnarWriter {
+public:
+    ColumnarWriter &addColumn( const std::string &name, std::vector< int64_t > values );
+    ColumnarWriter &addColumn( const std::string &name, std::vector< double > values );
+    ColumnarWriter &addColumn( const std::string &name, std::vector< std::string > values );
+    // throws std::runtime_error if the columns differ in length
+    void write( const std::string &filepath ) const;
+private:
+    class PendingColumn {
+    public:
+        std::string name;
+        ColumnarTable::ColumnType type;
+        std::vector< int64_t > ints;
+        std::vector< double > floats;
+        std::vector< std::string > strings;
+        size_t size() const;
+    };
+    std::vector< PendingColumn > columns;
+};
+
+}
+
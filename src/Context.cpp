@@ -0,0 +1,61 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <string>
+
+#include "Context.h"
+
+using namespace std;
+
+namespace Jinja2CppLight {
+
+Context::Context() :
+    top( std::make_shared< Layer >() ) {
+}
+// the top layer is written in place while this Context is its only user;
+// otherwise it is copied first, so snapshots and overlays sharing it don't
+// see the change
+Context &Context::set( const std::string &name, Value value ) {
+    if( top.use_count() > 1 ) {
+        top = std::make_shared< Layer >( *top );
+    }
+    top->values.set( name, std::move( value ) );
+    return *this;
+}
+const Value *Context::get( const std::string &name ) const {
+    for( const Layer *layer = top.get(); layer != 0; layer = layer->parent.get() ) {
+        const Value *value = layer->values.get( name );
+        if( value != 0 ) {
+            return value;
+        }
+    }
+    return 0;
+}
+const Value *Context::get( const MapKey &key ) const {
+    Value unused; // MapValue always returns its own entries
+    for( const Layer *layer = top.get(); layer != 0; layer = layer->parent.get() ) {
+        const Value *value = layer->values.get( key, unused );
+        if( value != 0 ) {
+            return value;
+        }
+    }
+    return 0;
+}
+Context Context::overlay() const {
+    Context result;
+    result.top->parent = top;
+    return result;
+}
+int Context::depth() const {
+    int layers = 0;
+    for( const Layer *layer = top.get(); layer != 0; layer = layer->parent.get() ) {
+        layers++;
+    }
+    return layers;
+}
+
+}
+
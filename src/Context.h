@@ -0,0 +1,61 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// values shared between many templates and renders, eg device constants:
+//
+//     Context device;
+//     device.set( "warpSize", 32 ).set( "maxThreads", 1024 );
+//     Context call = device.overlay();
+//     call.set( "n", 128 );
+//     mytemplate.render( call );
+//
+// names the template sets itself, with setValue, take precedence over the
+// context
+
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "Value.h"
+
+namespace Jinja2CppLight {
+
+// a stack of layers, each holding only the names set on it.  Layers are never
+// changed once another Context shares them, so:
+// - copying a Context is O(1), and gives an independent snapshot: set() on
+//   either copy copies just the top layer, the first time
+// - overlay() is O(1), and set() on the overlay leaves this one alone
+// - lookups search from the top layer down, so cost grows with the number of
+//   layers, not with the number of names
+//
+// const methods are safe from many threads at once; don't set() a Context
+// while something is rendering with it, hand over a copy instead
+class Context {
+public:
+    Context();
+
+    // adds or replaces name, in the top layer
+    Context &set( const std::string &name, Value value );
+    // 0 if name isn't set in any layer
+    const Value *get( const std::string &name ) const;
+    const Value *get( const MapKey &key ) const;
+    // an empty layer on top of this one
+    Context overlay() const;
+    int depth() const;
+
+private:
+    class Layer {
+    public:
+        std::shared_ptr< const Layer > parent;
+        MapValue values;
+    };
+
+    std::shared_ptr< Layer > top;
+};
+
+}
+
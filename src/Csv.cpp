@@ -0,0 +1,251 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+
+#include "Csv.h"
+#include "MappedFile.h"
+
+using namespace std;
+
+namespace Jinja2CppLight {
+
+namespace {
+
+// where the row starting at pos ends: the next newline that isn't inside
+// quotes.  Lines without quotes, the usual case, are found with one memchr
+const char *findRowEnd( const char *pos, const char *end ) {
+    const char *newline = (const char *)memchr( pos, '\n', end - pos );
+    if( newline == 0 ) {
+        newline = end;
+    }
+    if( memchr( pos, '"', newline - pos ) == 0 ) {
+        return newline;
+    }
+    bool inQuotes = false;
+    for( const char *c = pos; c < end; c++ ) {
+        if( *c == '"' ) {
+            inQuotes = !inQuotes;
+        } else if( *c == '\n' && !inQuotes ) {
+            return c;
+        }
+    }
+    return end;
+}
+// the delimiter after the field starting at pos, or rowEnd
+const char *findFieldEnd( const char *pos, const char *rowEnd, char delimiter ) {
+    if( pos < rowEnd && *pos == '"' ) {
+        pos++;
+        while( true ) {
+            const char *quote = (const char *)memchr( pos, '"', rowEnd - pos );
+            if( quote == 0 ) {
+                return rowEnd;
+            }
+            if( quote + 1 < rowEnd && quote[1] == '"' ) {
+                pos = quote + 2;
+            } else {
+                pos = quote + 1;
+                break;
+            }
+        }
+    }
+    const char *found = (const char *)memchr( pos, delimiter, rowEnd - pos );
+    return found == 0 ? rowEnd : found;
+}
+// without the \r of a \r\n
+const char *trimRowEnd( const char *start, const char *rowEnd ) {
+    return rowEnd > start && rowEnd[-1] == '\r' ? rowEnd - 1 : rowEnd;
+}
+// borrows the field's characters, unless "" escapes need undoing
+void fieldValue( const char *start, const char *end, Value &result ) {
+    size_t length = end - start;
+    if( length > 0 && *start == '"' ) {
+        start++;
+        length--;
+        if( length > 0 && start[length - 1] == '"' ) {
+            length--;
+        }
+        if( memchr( start, '"', length ) != 0 ) {
+            std::string unescaped;
+            for( size_t i = 0; i < length; i++ ) {
+                unescaped += start[i];
+                if( start[i] == '"' && i + 1 < length && start[i + 1] == '"' ) {
+                    i++;
+                }
+            }
+            result.setString( unescaped.data(), unescaped.size() );
+            return;
+        }
+    }
+    result = Value::borrow( start, length );
+}
+
+}
+
+class CsvData {
+public:
+    std::shared_ptr< const MappedFile > file;
+    char delimiter;
+    std::vector< std::string > columns;
+    const char *body; // the line after the header
+    const char *end;
+
+    int findColumn( const MapKey &key ) const {
+        size_t hint = key.hint.load( std::memory_order_relaxed );
+        if( hint < columns.size() && columns[hint] == key.name ) {
+            return (int)hint;
+        }
+        for( size_t i = 0; i < columns.size(); i++ ) {
+            if( columns[i] == key.name ) {
+                key.hint.store( i, std::memory_order_relaxed );
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+};
+
+namespace {
+
+// the current row of a CsvIterator.  Fields are split up on demand, only as
+// far as the furthest one read so far
+class CsvRow : public Map {
+public:
+    const CsvData *data;
+    const char *start;
+    const char *end;
+    mutable std::vector< const char * > fieldEnds;
+
+    CsvRow( const CsvData *data ) :
+        data( data ),
+        start( 0 ),
+        end( 0 ) {
+    }
+    size_t size() const {
+        return data->columns.size();
+    }
+    const Value *get( const MapKey &key, Value &scratch ) const {
+        int column = data->findColumn( key );
+        return column < 0 ? 0 : field( column, scratch );
+    }
+    // a row with too few fields has empty ones at the end
+    const Value *field( int index, Value &scratch ) const {
+        while( (int)fieldEnds.size() <= index ) {
+            if( !fieldEnds.empty() && fieldEnds.back() >= end ) {
+                scratch.setString( "", 0 );
+                return &scratch;
+            }
+            const char *fieldStart = fieldEnds.empty() ? start : fieldEnds.back() + 1;
+            fieldEnds.push_back( findFieldEnd( fieldStart, end, data->delimiter ) );
+        }
+        fieldValue( index == 0 ? start : fieldEnds[index - 1] + 1, fieldEnds[index], scratch );
+        return &scratch;
+    }
+    void render( Output &output ) const {
+        Value scratch;
+        output.write( "{", 1 );
+        for( size_t i = 0; i < data->columns.size(); i++ ) {
+            if( i > 0 ) {
+                output.write( ", ", 2 );
+            }
+            output.write( data->columns[i] );
+            output.write( ": ", 2 );
+            field( (int)i, scratch )->render( output );
+        }
+        output.write( "}", 1 );
+    }
+};
+
+// one row at a time; each row replaces the last, so nothing is allocated per
+// row once fieldEnds has grown to the number of columns
+class CsvIterator : public Iterator {
+public:
+    std::shared_ptr< const CsvData > data;
+    const char *pos;
+    CsvRow row;
+
+    CsvIterator( const std::shared_ptr< const CsvData > &data ) :
+        data( data ),
+        pos( data->body ),
+        row( data.get() ) {
+    }
+    const Value *next( Value &scratch ) {
+        const char *end = data->end;
+        while( pos < end && ( *pos == '\n' || *pos == '\r' ) ) {
+            pos++; // blank lines
+        }
+        if( pos >= end ) {
+            return 0;
+        }
+        const char *rowEnd = findRowEnd( pos, end );
+        row.start = pos;
+        row.end = trimRowEnd( pos, rowEnd );
+        row.fieldEnds.clear();
+        pos = rowEnd + 1;
+        scratch = Value( std::shared_ptr< const Map >( std::shared_ptr< const Map >(), &row ) );
+        return &scratch;
+    }
+};
+
+class CsvRows : public Iterable {
+public:
+    std::shared_ptr< const CsvData > data;
+
+    CsvRows( const std::shared_ptr< const CsvData > &data ) :
+        data( data ) {
+    }
+    std::unique_ptr< Iterator > iterate() const {
+        return std::unique_ptr< Iterator >( new CsvIterator( data ) );
+    }
+};
+
+}
+
+CsvTable::CsvTable( const std::string &filepath, char delimiter ) {
+    std::shared_ptr< CsvData > newData = std::make_shared< CsvData >();
+    std::shared_ptr< const MappedFile > file = std::make_shared< const MappedFile >( filepath );
+    file->adviseSequential();
+    newData->file = file;
+    newData->delimiter = delimiter;
+    const char *pos = file->data;
+    const char *end = file->data + file->length;
+    if( pos == end ) {
+        throw runtime_error( filepath + " has no header line" );
+    }
+    const char *headerEnd = findRowEnd( pos, end );
+    const char *rowEnd = trimRowEnd( pos, headerEnd );
+    Value name;
+    while( true ) {
+        const char *fieldEnd = findFieldEnd( pos, rowEnd, delimiter );
+        fieldValue( pos, fieldEnd, name );
+        newData->columns.push_back( name.asString() );
+        if( fieldEnd >= rowEnd ) {
+            break;
+        }
+        pos = fieldEnd + 1;
+    }
+    newData->body = headerEnd < end ? headerEnd + 1 : end;
+    newData->end = end;
+    data = newData;
+}
+int CsvTable::numColumns() const {
+    return (int)data->columns.size();
+}
+const std::string &CsvTable::columnName( int column ) const {
+    return data->columns[column];
+}
+int CsvTable::findColumn( const std::string &name ) const {
+    return data->findColumn( MapKey( name ) );
+}
+Value CsvTable::rows() const {
+    return Value( std::shared_ptr< const Iterable >( std::make_shared< CsvRows >( data ) ) );
+}
+
+}
+
@@ -0,0 +1,49 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// reports straight from CSV, or other delimited, files:
+//
+//     CsvTable sales( "sales.csv" );
+//     mytemplate.setValue( "sales", sales.rows() );
+//     // {% for row in sales %}{{ row.item }}: {{ row.price }}{% endfor %}
+//     mytemplate.renderToFile( "report.txt" );
+//
+// the first line names the columns.  The file is mapped, and rows are read
+// as the loop reaches them, so memory use doesn't grow with the file, and a
+// row's fields are only split up as far as the template reads into it.
+// Fields are strings, pointing into the file unless they contain "" escapes
+// ("1.5" renders the same either way); quotes follow RFC 4180
+
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "Value.h"
+
+namespace Jinja2CppLight {
+
+class CsvData;
+
+class CsvTable {
+public:
+    // throws std::runtime_error if the file can't be read, or has no header
+    CsvTable( const std::string &filepath, char delimiter = ',' );
+
+    int numColumns() const;
+    const std::string &columnName( int column ) const;
+    // -1 if there is no such column
+    int findColumn( const std::string &name ) const;
+
+    // an Iterable of rows, each a Map with a key per column.  Keeps the file
+    // mapped for as long as it exists
+    Value rows() const;
+private:
+    std::shared_ptr< const CsvData > data;
+};
+
+}
+
@@ -0,0 +1,693 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include "Expression.h"
+#include "Jinja2CppLight.h"
+
+using namespace std;
+
+namespace Jinja2CppLight {
+
+namespace {
+
+const Value NONE_VALUE;
+
+class Token {
+public:
+    enum Kind { NAME, INTEGER, FLOAT, STRING, OPERATOR, END };
+    Kind kind;
+    std::string text; // for a STRING, without the quotes, and unescaped
+
+    Token( Kind kind, const std::string &text ) :
+        kind( kind ),
+        text( text ) {
+    }
+    bool is( const char *op ) const {
+        return ( kind == OPERATOR || kind == NAME ) && text == op;
+    }
+};
+
+bool isNameStart( char c ) {
+    return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || c == '_';
+}
+bool isDigit( char c ) {
+    return c >= '0' && c <= '9';
+}
+
+std::vector< Token > tokenize( const std::string &source ) {
+    static const char *const OPERATORS[] = { "//", "==", "!=", "<=", ">=",
+        "+", "-", "*", "/", "%", "<", ">", "(", ")", "[", "]", "." };
+    std::vector< Token > tokens;
+    size_t pos = 0;
+    while( pos < source.length() ) {
+        char c = source[pos];
+        if( c == ' ' || c == '\t' || c == '\n' || c == '\r' ) {
+            pos++;
+        } else if( isNameStart( c ) ) {
+            size_t end = pos + 1;
+            while( end < source.length() && ( isNameStart( source[end] ) || isDigit( source[end] ) ) ) {
+                end++;
+            }
+            tokens.push_back( Token( Token::NAME, source.substr( pos, end - pos ) ) );
+            pos = end;
+        } else if( isDigit( c ) ) {
+            size_t end = pos;
+            while( end < source.length() && isDigit( source[end] ) ) {
+                end++;
+            }
+            Token::Kind kind = Token::INTEGER;
+            if( end + 1 < source.length() && source[end] == '.' && isDigit( source[end + 1] ) ) {
+                kind = Token::FLOAT;
+                end++;
+                while( end < source.length() && isDigit( source[end] ) ) {
+                    end++;
+                }
+            }
+            if( end < source.length() && ( source[end] == 'e' || source[end] == 'E' ) ) {
+                size_t exponent = end + 1;
+                if( exponent < source.length() && ( source[exponent] == '+' || source[exponent] == '-' ) ) {
+                    exponent++;
+                }
+                if( exponent < source.length() && isDigit( source[exponent] ) ) {
+                    kind = Token::FLOAT;
+                    end = exponent;
+                    while( end < source.length() && isDigit( source[end] ) ) {
+                        end++;
+                    }
+                }
+            }
+            tokens.push_back( Token( kind, source.substr( pos, end - pos ) ) );
+            pos = end;
+        } else if( c == '"' || c == '\'' ) {
+            std::string text;
+            size_t end = pos + 1;
+            while( end < source.length() && source[end] != c ) {
+                if( source[end] == '\\' && end + 1 < source.length() ) {
+                    end++;
+                    char escaped = source[end];
+                    text += escaped == 'n' ? '\n' : escaped == 't' ? '\t' : escaped;
+                } else {
+                    text += source[end];
+                }
+                end++;
+            }
+            if( end >= source.length() ) {
+                throw render_error( "unterminated string in " + source );
+            }
+            tokens.push_back( Token( Token::STRING, text ) );
+            pos = end + 1;
+        } else {
+            size_t i = 0;
+            const size_t numOperators = sizeof( OPERATORS ) / sizeof( OPERATORS[0] );
+            while( i < numOperators && source.compare( pos, strlen( OPERATORS[i] ), OPERATORS[i] ) != 0 ) {
+                i++;
+            }
+            if( i == numOperators ) {
+                throw render_error( "unexpected " + source.substr( pos, 1 ) + " in " + source );
+            }
+            tokens.push_back( Token( Token::OPERATOR, OPERATORS[i] ) );
+            pos += strlen( OPERATORS[i] );
+        }
+    }
+    tokens.push_back( Token( Token::END, "" ) );
+    return tokens;
+}
+
+// recursive descent, lowest precedence first, emitting code as it goes
+class Compiler {
+public:
+    Expression &expression;
+    const Template &thetemplate;
+    const LoopScope &scope;
+    std::vector< Token > tokens;
+    size_t pos;
+    int depth;
+
+    Compiler( Expression &expression, const Template &thetemplate, const LoopScope &scope ) :
+        expression( expression ),
+        thetemplate( thetemplate ),
+        scope( scope ),
+        tokens( tokenize( expression.source ) ),
+        pos( 0 ),
+        depth( 0 ) {
+    }
+    void compile() {
+        if( tokens[0].kind == Token::END ) {
+            throw render_error( "expression expected" );
+        }
+        parseOr();
+        if( tokens[pos].kind != Token::END ) {
+            if( expression.isVariable() ) {
+                throw render_error( "Unexpected expression after variable name: " + tokens[pos].text );
+            }
+            throw render_error( "unexpected " + describe( tokens[pos] ) + " in " + expression.source );
+        }
+    }
+private:
+    std::string describe( const Token &token ) const {
+        return token.kind == Token::STRING ? "\"" + token.text + "\"" : token.text;
+    }
+    bool accept( const char *op ) {
+        if( tokens[pos].is( op ) ) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+    void expect( const char *op ) {
+        if( !accept( op ) ) {
+            throw render_error( std::string( "missing " ) + op + " in " + expression.source );
+        }
+    }
+    // tracks how deep the stack gets
+    int emit( Expression::Op op, int operand ) {
+        switch( op ) {
+            case Expression::CONSTANT:
+            case Expression::VARIABLE:
+                depth++;
+                break;
+            case Expression::STEP:
+            case Expression::NOT:
+            case Expression::NEGATE:
+                break;
+            default:
+                depth--; // binary operators, INDEX, and the jumps when they don't jump
+        }
+        if( depth > expression.stackSize ) {
+            expression.stackSize = depth;
+        }
+        expression.code.push_back( Expression::Instruction( op, operand ) );
+        return (int)expression.code.size() - 1;
+    }
+    void emitConstant( const Value &value ) {
+        expression.constants.push_back( value );
+        emit( Expression::CONSTANT, (int)expression.constants.size() - 1 );
+    }
+    void emitBool( bool value ) {
+        Value constant;
+        constant.setBool( value );
+        emitConstant( constant );
+    }
+    // a or b: if a is true, that's the answer, otherwise b is
+    void parseOr() {
+        parseAnd();
+        while( accept( "or" ) ) {
+            int jump = emit( Expression::JUMP_IF_TRUE_OR_POP, 0 );
+            parseAnd();
+            expression.code[jump].operand = (int)expression.code.size();
+        }
+    }
+    void parseAnd() {
+        parseNot();
+        while( accept( "and" ) ) {
+            int jump = emit( Expression::JUMP_IF_FALSE_OR_POP, 0 );
+            parseNot();
+            expression.code[jump].operand = (int)expression.code.size();
+        }
+    }
+    void parseNot() {
+        if( accept( "not" ) ) {
+            parseNot();
+            emit( Expression::NOT, 0 );
+        } else {
+            parseComparison();
+        }
+    }
+    void parseComparison() {
+        static const char *const OPERATORS[] = { "==", "!=", "<", "<=", ">", ">=" };
+        static const Expression::Op OPS[] = { Expression::EQUAL, Expression::NOT_EQUAL, Expression::LESS,
+            Expression::LESS_EQUAL, Expression::GREATER, Expression::GREATER_EQUAL };
+        parseAdditive();
+        for( int i = 0; i < 6; i++ ) {
+            if( accept( OPERATORS[i] ) ) {
+                parseAdditive();
+                emit( OPS[i], 0 );
+                return;
+            }
+        }
+    }
+    void parseAdditive() {
+        parseMultiplicative();
+        while( true ) {
+            if( accept( "+" ) ) {
+                parseMultiplicative();
+                emit( Expression::ADD, 0 );
+            } else if( accept( "-" ) ) {
+                parseMultiplicative();
+                emit( Expression::SUBTRACT, 0 );
+            } else {
+                return;
+            }
+        }
+    }
+    void parseMultiplicative() {
+        parseUnary();
+        while( true ) {
+            Expression::Op op;
+            if( accept( "*" ) ) {
+                op = Expression::MULTIPLY;
+            } else if( accept( "//" ) ) {
+                op = Expression::FLOOR_DIVIDE;
+            } else if( accept( "/" ) ) {
+                op = Expression::DIVIDE;
+            } else if( accept( "%" ) ) {
+                op = Expression::MODULO;
+            } else {
+                return;
+            }
+            parseUnary();
+            emit( op, 0 );
+        }
+    }
+    void parseUnary() {
+        if( accept( "-" ) ) {
+            const size_t operandStart = expression.code.size();
+            parseUnary();
+            // a negative number is just a constant; but only if the operand is
+            // nothing else, eg not -(a or 1), whose last instruction is a constant
+            Value *constant = expression.code.size() == operandStart + 1 && expression.code.back().op == Expression::CONSTANT ?
+                &expression.constants[expression.code.back().operand] : 0;
+            if( constant != 0 && constant->type() == Value::INT ) {
+                constant->setInt( (int64_t)( 0 - (uint64_t)constant->asInt() ) );
+            } else if( constant != 0 && constant->type() == Value::FLOAT ) {
+                constant->setFloat( -constant->asFloat() );
+            } else {
+                emit( Expression::NEGATE, 0 );
+            }
+        } else if( accept( "+" ) ) {
+            parseUnary();
+        } else {
+            parsePostfix();
+        }
+    }
+    // a name followed by .key, [0] or ["key"] stays a single VariableRef, with
+    // its path resolved at compile time, as in {{ cfg.tile.x }}.  Any other
+    // subscript, eg image[i + 1], is computed while rendering
+    void parsePostfix() {
+        const Token token = tokens[pos++];
+        VariableRef ref;
+        bool pending = false; // ref still to be emitted
+        if( token.kind == Token::INTEGER ) {
+            emitConstant( Value( (long long)strtoll( token.text.c_str(), 0, 10 ) ) );
+        } else if( token.kind == Token::FLOAT ) {
+            emitConstant( Value( strtod( token.text.c_str(), 0 ) ) );
+        } else if( token.kind == Token::STRING ) {
+            emitConstant( Value( token.text ) );
+        } else if( token.is( "(" ) ) {
+            parseOr();
+            expect( ")" );
+        } else if( token.is( "True" ) || token.is( "true" ) ) {
+            emitBool( true );
+        } else if( token.is( "False" ) || token.is( "false" ) ) {
+            emitBool( false );
+        } else if( token.is( "None" ) || token.is( "none" ) ) {
+            emitConstant( Value() );
+        } else if( token.kind == Token::NAME && !token.is( "and" ) && !token.is( "or" ) && !token.is( "not" ) ) {
+            ref = thetemplate.resolve( token.text, scope );
+            pending = true;
+        } else if( token.kind == Token::END ) {
+            throw render_error( "expression expected in " + expression.source );
+        } else {
+            throw render_error( "unexpected " + describe( token ) + " in " + expression.source );
+        }
+        while( true ) {
+            std::string key;
+            int index = -1;
+            std::string written;
+            if( accept( "." ) ) {
+                const Token &keyToken = tokens[pos++];
+                if( keyToken.kind != Token::NAME && keyToken.kind != Token::INTEGER ) {
+                    throw render_error( "key expected in " + expression.source );
+                }
+                key = keyToken.text;
+                if( keyToken.kind == Token::INTEGER ) {
+                    index = atoi( key.c_str() );
+                }
+                written = "." + key;
+            } else if( tokens[pos].is( "[" ) && ( tokens[pos + 1].kind == Token::INTEGER || tokens[pos + 1].kind == Token::STRING )
+                    && tokens[pos + 2].is( "]" ) ) {
+                const Token &keyToken = tokens[pos + 1];
+                pos += 3;
+                key = keyToken.text;
+                if( keyToken.kind == Token::INTEGER ) {
+                    index = atoi( key.c_str() );
+                }
+                written = "[" + describe( keyToken ) + "]";
+            } else if( accept( "[" ) ) {
+                if( pending ) {
+                    flush( ref );
+                    pending = false;
+                }
+                parseOr();
+                expect( "]" );
+                emit( Expression::INDEX, 0 );
+                continue;
+            } else {
+                break;
+            }
+            if( pending ) {
+                ref.path.push_back( PathStep( key, index ) );
+                ref.name += written;
+            } else {
+                expression.steps.push_back( PathStep( key, index ) );
+                emit( Expression::STEP, (int)expression.steps.size() - 1 );
+            }
+        }
+        if( pending ) {
+            flush( ref );
+        }
+    }
+    void flush( const VariableRef &ref ) {
+        scope.noteRead( ref );
+        expression.variables.push_back( ref );
+        emit( Expression::VARIABLE, (int)expression.variables.size() - 1 );
+    }
+};
+
+const char *typeName( const Value &value ) {
+    switch( value.type() ) {
+        case Value::INT:
+            return "int";
+        case Value::FLOAT:
+            return "float";
+        case Value::STRING:
+            return "string";
+        case Value::SEQUENCE:
+            return "sequence";
+        case Value::MAP:
+            return "map";
+        case Value::ITERABLE:
+            return "iterable";
+        default:
+            return "None";
+    }
+}
+const char *opName( Expression::Op op ) {
+    static const char *const NAMES[] = { "+", "-", "*", "/", "//", "%", "==", "!=", "<", "<=", ">", ">=" };
+    return NAMES[op - Expression::ADD];
+}
+bool isNumeric( const Value &value ) {
+    return value.type() == Value::INT || value.type() == Value::FLOAT;
+}
+double asDouble( const Value &value ) {
+    return value.type() == Value::INT ? (double)value.asInt() : value.asFloat();
+}
+int compareStrings( const Value &left, const Value &right ) {
+    size_t leftLength = left.stringLength();
+    size_t rightLength = right.stringLength();
+    int result = memcmp( left.stringData(), right.stringData(), leftLength < rightLength ? leftLength : rightLength );
+    if( result != 0 ) {
+        return result;
+    }
+    return leftLength < rightLength ? -1 : leftLength > rightLength ? 1 : 0;
+}
+template< typename T >
+bool compare( Expression::Op op, T left, T right ) {
+    switch( op ) {
+        case Expression::EQUAL:
+            return left == right;
+        case Expression::NOT_EQUAL:
+            return left != right;
+        case Expression::LESS:
+            return left < right;
+        case Expression::LESS_EQUAL:
+            return left <= right;
+        case Expression::GREATER:
+            return left > right;
+        default:
+            return left >= right;
+    }
+}
+// ints stay ints, except for /; python's rounding for // and %
+bool intArithmetic( Expression::Op op, int64_t left, int64_t right, Value &result ) {
+    switch( op ) {
+        case Expression::ADD:
+            result.setInt( (int64_t)( (uint64_t)left + (uint64_t)right ) );
+            return true;
+        case Expression::SUBTRACT:
+            result.setInt( (int64_t)( (uint64_t)left - (uint64_t)right ) );
+            return true;
+        case Expression::MULTIPLY:
+            result.setInt( (int64_t)( (uint64_t)left * (uint64_t)right ) );
+            return true;
+        case Expression::DIVIDE:
+            if( right == 0 ) {
+                return false;
+            }
+            result.setFloat( (double)left / (double)right );
+            return true;
+        case Expression::FLOOR_DIVIDE: {
+            if( right == 0 ) {
+                return false;
+            }
+            if( right == -1 ) {
+                result.setInt( (int64_t)( 0 - (uint64_t)left ) );
+                return true;
+            }
+            int64_t quotient = left / right;
+            if( left % right != 0 && ( left < 0 ) != ( right < 0 ) ) {
+                quotient--;
+            }
+            result.setInt( quotient );
+            return true;
+        }
+        default: {
+            if( right == 0 ) {
+                return false;
+            }
+            int64_t remainder = right == -1 ? 0 : left % right;
+            if( remainder != 0 && ( remainder < 0 ) != ( right < 0 ) ) {
+                remainder += right;
+            }
+            result.setInt( remainder );
+            return true;
+        }
+    }
+}
+bool floatArithmetic( Expression::Op op, double left, double right, Value &result ) {
+    switch( op ) {
+        case Expression::ADD:
+            result.setFloat( left + right );
+            return true;
+        case Expression::SUBTRACT:
+            result.setFloat( left - right );
+            return true;
+        case Expression::MULTIPLY:
+            result.setFloat( left * right );
+            return true;
+        case Expression::DIVIDE:
+            if( right == 0 ) {
+                return false;
+            }
+            result.setFloat( left / right );
+            return true;
+        case Expression::FLOOR_DIVIDE:
+            if( right == 0 ) {
+                return false;
+            }
+            result.setFloat( std::floor( left / right ) );
+            return true;
+        default: {
+            if( right == 0 ) {
+                return false;
+            }
+            double remainder = std::fmod( left, right );
+            if( remainder != 0 && ( remainder < 0 ) != ( right < 0 ) ) {
+                remainder += right;
+            }
+            result.setFloat( remainder );
+            return true;
+        }
+    }
+}
+// result may be what left or right was read from, so both are read first
+void binary( Expression::Op op, const Value &left, const Value &right, Value &result, const std::string &source ) {
+    if( op >= Expression::EQUAL ) {
+        bool answer;
+        if( left.type() == Value::INT && right.type() == Value::INT ) {
+            answer = compare( op, left.asInt(), right.asInt() );
+        } else if( isNumeric( left ) && isNumeric( right ) ) {
+            answer = compare( op, asDouble( left ), asDouble( right ) );
+        } else if( left.type() == Value::STRING && right.type() == Value::STRING ) {
+            answer = compare( op, compareStrings( left, right ), 0 );
+        } else if( op == Expression::EQUAL || op == Expression::NOT_EQUAL ) {
+            // anything else is only equal to None, if it's None itself
+            bool equal = left.type() == Value::NONE && right.type() == Value::NONE;
+            answer = op == Expression::EQUAL ? equal : !equal;
+        } else {
+            throw render_error( std::string( "cannot compare " ) + typeName( left ) + " and " + typeName( right ) + " in " + source );
+        }
+        result.setBool( answer );
+        return;
+    }
+    bool ok;
+    if( left.type() == Value::INT && right.type() == Value::INT ) {
+        ok = intArithmetic( op, left.asInt(), right.asInt(), result );
+    } else if( isNumeric( left ) && isNumeric( right ) ) {
+        ok = floatArithmetic( op, asDouble( left ), asDouble( right ), result );
+    } else if( op == Expression::ADD && left.type() == Value::STRING && right.type() == Value::STRING ) {
+        const size_t leftLength = left.stringLength();
+        const size_t length = leftLength + right.stringLength();
+        if( length <= Value::SMALL_STRING_CAPACITY ) {
+            char joined[Value::SMALL_STRING_CAPACITY];
+            memcpy( joined, left.stringData(), leftLength );
+            memcpy( joined + leftLength, right.stringData(), length - leftLength );
+            result.setString( joined, length );
+        } else {
+            std::string joined;
+            joined.reserve( length );
+            joined.append( left.stringData(), leftLength );
+            joined.append( right.stringData(), length - leftLength );
+            result = Value( std::move( joined ) );
+        }
+        return;
+    } else {
+        throw render_error( std::string( "cannot apply " ) + opName( op ) + " to " + typeName( left ) + " and " + typeName( right ) + " in " + source );
+    }
+    if( !ok ) {
+        throw render_error( "division by zero in " + source );
+    }
+}
+// what an element lookup found: None if nothing, and LAZY values computed
+const Value *settle( const Value *element, Value &scratch ) {
+    if( element == 0 ) {
+        return &NONE_VALUE;
+    }
+    if( element->type() != Value::LAZY ) {
+        return element;
+    }
+    // computed each time: the container may be refilled in place, so where
+    // the element lives doesn't identify it
+    element = RenderContext::compute( *element, scratch );
+    return element == 0 ? &NONE_VALUE : element;
+}
+const Value *step( const Value &container, const PathStep &step, Value &scratch ) {
+    if( container.type() == Value::SEQUENCE && step.index >= 0 ) {
+        const Sequence &sequence = container.asSequence();
+        return (size_t)step.index < sequence.size() ? sequence.at( step.index, scratch ) : 0;
+    }
+    if( container.type() == Value::MAP ) {
+        return container.asMap().get( step.key, scratch );
+    }
+    return 0;
+}
+// whichever of stack entry i's two Values it isn't using
+Value &spare( const Value **stack, Value *values, int i ) {
+    return stack[i] == &values[2 * i] ? values[2 * i + 1] : values[2 * i];
+}
+// sequences take an int, negative counting from the end; maps take a string
+const Value *element( const Value &container, const Value &index, Value &scratch ) {
+    if( container.type() == Value::SEQUENCE && index.type() == Value::INT ) {
+        const Sequence &sequence = container.asSequence();
+        int64_t position = index.asInt();
+        if( position < 0 ) {
+            position += (int64_t)sequence.size();
+        }
+        return position >= 0 && (size_t)position < sequence.size() ? sequence.at( (size_t)position, scratch ) : 0;
+    }
+    if( container.type() == Value::MAP && index.type() == Value::STRING ) {
+        MapKey key( index.asString() );
+        return container.asMap().get( key, scratch );
+    }
+    return 0;
+}
+
+}
+
+void Expression::compile( const std::string &source, const Template &thetemplate, const LoopScope &scope ) {
+    this->source = source;
+    code.clear();
+    constants.clear();
+    variables.clear();
+    steps.clear();
+    stackSize = 0;
+    Compiler( *this, thetemplate, scope ).compile();
+}
+// each stack entry has two Values to compute into, so a result never
+// overwrites the value it's computed from
+const Value *Expression::evaluate( RenderContext &context ) const {
+    if( (int)context.expressionStack.size() < stackSize ) {
+        context.expressionStack.resize( stackSize );
+        context.expressionValues.resize( 2 * stackSize );
+    }
+    const Value **stack = &context.expressionStack[0];
+    Value *values = &context.expressionValues[0];
+    int top = -1;
+    for( size_t pc = 0; pc < code.size(); pc++ ) {
+        const Instruction &instruction = code[pc];
+        switch( instruction.op ) {
+            case CONSTANT:
+                stack[++top] = &constants[instruction.operand];
+                break;
+            case VARIABLE: {
+                top++;
+                const Value *value = context.lookup( variables[instruction.operand], values[2 * top] );
+                stack[top] = value == 0 ? &NONE_VALUE : value;
+                break;
+            }
+            case STEP: {
+                Value &scratch = spare( stack, values, top );
+                stack[top] = settle( step( *stack[top], steps[instruction.operand], scratch ), scratch );
+                break;
+            }
+            case INDEX: {
+                const Value &index = *stack[top--];
+                Value &scratch = spare( stack, values, top );
+                stack[top] = settle( element( *stack[top], index, scratch ), scratch );
+                break;
+            }
+            case NOT: {
+                const bool truth = stack[top]->isTrue();
+                Value &result = spare( stack, values, top );
+                result.setBool( !truth );
+                stack[top] = &result;
+                break;
+            }
+            case NEGATE: {
+                const Value &operand = *stack[top];
+                Value &result = spare( stack, values, top );
+                if( operand.type() == Value::INT ) {
+                    result.setInt( (int64_t)( 0 - (uint64_t)operand.asInt() ) );
+                } else if( operand.type() == Value::FLOAT ) {
+                    result.setFloat( -operand.asFloat() );
+                } else {
+                    throw render_error( std::string( "cannot negate " ) + typeName( operand ) + " in " + source );
+                }
+                stack[top] = &result;
+                break;
+            }
+            case JUMP_IF_FALSE_OR_POP:
+                if( !stack[top]->isTrue() ) {
+                    pc = instruction.operand - 1;
+                } else {
+                    top--;
+                }
+                break;
+            case JUMP_IF_TRUE_OR_POP:
+                if( stack[top]->isTrue() ) {
+                    pc = instruction.operand - 1;
+                } else {
+                    top--;
+                }
+                break;
+            default: {
+                const Value &right = *stack[top--];
+                Value &result = spare( stack, values, top );
+                binary( instruction.op, *stack[top], right, result, source );
+                stack[top] = &result;
+            }
+        }
+    }
+    return stack[0];
+}
+
+}
@@ -0,0 +1,168 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// names and expressions, as used in {{ ... }} and {% if ... %}:
+//
+//     {{ i * 4 + 1 }}  {{ image[i + 1] }}  {{ cfg.tile.x // 2 }}
+//     {% if n > 8 and not vec %}
+//
+// supports + - * / // % on numbers, + on strings, comparisons, and, or, not,
+// parentheses, literals ( 3, 2.5, "text", 'text', True, False, None ),
+// and indexing by . and [], with any expression inside the brackets.  As in
+// Jinja2, / always gives a float, // and % round towards minus infinity, and
+// and / or give back one of their operands.  Comparisons, not, True and
+// False give booleans, which render as True and False, but are 1 and 0 in
+// arithmetic.  A name that isn't defined is None, which is false, so
+// {% if cfg and cfg.x > 2 %} is fine without cfg
+//
+// each expression is compiled once, into a short program for a small stack
+// machine, with every name resolved as for {{ name }}.  Evaluating works on
+// Values in place, and only allocates to build a string longer than
+// Value::SMALL_STRING_CAPACITY, or to look up a map key that isn't known
+// until the template is rendered
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Value.h"
+
+namespace Jinja2CppLight {
+
+class Template;
+class RenderContext;
+
+// one step of an access path: the .tile in cfg.tile, the ["k"] in cfg["k"],
+// or the [0] in items[0]
+class PathStep {
+public:
+    MapKey key;
+    int index; // for sequences; -1 unless the key is a number
+
+    PathStep( const std::string &key, int index ) :
+        key( key ),
+        index( index ) {
+    }
+};
+
+// where a name used in the template lives: either the variable of an
+// enclosing for loop, as an index into the RenderContext's frame stack, or
+// one of the Template's values.  Decided once, at compile time, so inner
+// loops simply shadow outer names.  Any access path after the name, eg
+// cfg.tile.x, is parsed at compile time too
+class VariableRef {
+public:
+    std::string name; // as written in the template, eg cfg.tile.x
+    int frame; // -1 if not a loop variable
+    int slot; // -1 if a loop variable
+    std::vector< PathStep > path;
+    VariableRef() :
+        frame( -1 ),
+        slot( -1 ) {
+    }
+};
+
+// loop variables visible at the current point of compilation, innermost last
+class LoopScope {
+public:
+    std::vector< std::string > varNames;
+    mutable std::vector< bool > used; // by varNames index: whether anything resolved to it
+    // by varNames index, for a loop's loop variable: whether anything reads
+    // more of it than loop.index, loop.index0 or loop.first, so that a
+    // filtered loop has to count its matches before it starts
+    mutable std::vector< bool > needsLength;
+    int maxDepth;
+    LoopScope() :
+        maxDepth( 0 ) {
+    }
+    int push( const std::string &varName ) {
+        varNames.push_back( varName );
+        used.push_back( false );
+        needsLength.push_back( false );
+        if( (int)varNames.size() > maxDepth ) {
+            maxDepth = (int)varNames.size();
+        }
+        return (int)varNames.size() - 1;
+    }
+    void pop() {
+        varNames.pop_back();
+        used.pop_back();
+        needsLength.pop_back();
+    }
+    // ref is complete, with its whole path
+    void noteRead( const VariableRef &ref ) const {
+        if( ref.frame < 0 || varNames[ref.frame] != "loop" ) {
+            return;
+        }
+        const std::string attribute = ref.path.empty() ? "" : ref.path[0].key.name;
+        if( attribute != "index" && attribute != "index0" && attribute != "first" ) {
+            needsLength[ref.frame] = true;
+        }
+    }
+};
+
+class Expression {
+public:
+    enum Op {
+        CONSTANT, // push constants[operand]
+        VARIABLE, // push variables[operand], or None
+        STEP, // replace the top with its steps[operand], or None
+        INDEX, // pop the index, replace the container with its element, or None
+        NOT, NEGATE,
+        ADD, SUBTRACT, MULTIPLY, DIVIDE, FLOOR_DIVIDE, MODULO,
+        EQUAL, NOT_EQUAL, LESS, LESS_EQUAL, GREATER, GREATER_EQUAL,
+        JUMP_IF_FALSE_OR_POP, // to operand, keeping the top, if it's false; for and
+        JUMP_IF_TRUE_OR_POP // for or
+    };
+    class Instruction {
+    public:
+        Op op;
+        int operand;
+        Instruction( Op op, int operand ) :
+            op( op ),
+            operand( operand ) {
+        }
+    };
+
+    std::string source; // as written, for error messages
+    std::vector< Instruction > code;
+    std::vector< Value > constants;
+    std::vector< VariableRef > variables;
+    std::vector< PathStep > steps;
+    int stackSize; // deepest the stack gets
+
+    Expression() :
+        stackSize( 0 ) {
+    }
+    // throws render_error if source isn't a valid expression
+    void compile( const std::string &source, const Template &thetemplate, const LoopScope &scope );
+    // true if the expression is just a name, eg cfg.tile.x; variables[0] is
+    // that name then
+    bool isVariable() const {
+        return code.size() == 1 && code[0].op == VARIABLE;
+    }
+    // for name == 3, or 3 == name, where name is a plain name: the name and
+    // the number
+    bool isIntEquality( const VariableRef **p_variable, int64_t *p_value ) const {
+        if( code.size() != 3 || code[2].op != EQUAL ) {
+            return false;
+        }
+        int variable = code[0].op == VARIABLE ? 0 : code[1].op == VARIABLE ? 1 : -1;
+        if( variable < 0 || code[1 - variable].op != CONSTANT || constants[code[1 - variable].operand].type() != Value::INT ) {
+            return false;
+        }
+        *p_variable = &variables[code[variable].operand];
+        *p_value = constants[code[1 - variable].operand].asInt();
+        return true;
+    }
+    // never 0: a name that isn't defined gives None.  The result might live
+    // in context's expression stack, so is only valid until the next
+    // expression is evaluated
+    const Value *evaluate( RenderContext &context ) const;
+};
+
+}
@@ -18,20 +18,23 @@ using namespace std;
 
 namespace
 {
-    const std::string JINJA2_TRUE = "True";
-    const std::string JINJA2_FALSE = "False";
     const std::string JINJA2_NOT = "not";
 }
 
 namespace Jinja2CppLight {
 
+const std::string JINJA2_TRUE = "True";
+const std::string JINJA2_FALSE = "False";
+
 #undef VIRTUAL
 #define VIRTUAL
 #undef STATIC
 #define STATIC
 
 Template::Template( std::string sourceCode ) :
-    sourceCode( sourceCode )
+    sourceCode( sourceCode ),
+    compiled( 0 ),
+    lastRenderSize( 0 )
 {}
 
 STATIC bool Template::isNumber( std::string astring, int *p_value ) {
@@ -44,42 +47,310 @@ STATIC bool Template::isNumber( std::string astring, int *p_value ) {
     return false;
 }
 VIRTUAL Template::~Template() {
-    valueByName.clear();
+    values.clear();
 }
 Template &Template::setValue( std::string name, int value ) {
-    valueByName[ name ] = std::make_shared<IntValue>( value );
+    set( slot( name ), Value( value ) );
     return *this;
 }
 Template &Template::setValue( std::string name, float value ) {
-    valueByName[ name ] = std::make_shared<FloatValue>( value );
+    set( slot( name ), Value( value ) );
+    return *this;
+}
+Template &Template::setValue( std::string name, double value ) {
+    set( slot( name ), Value( value ) );
+    return *this;
+}
+Template &Template::setValue( std::string name, const char *value ) {
+    set( slot( name ), Value( value ) );
     return *this;
 }
 Template &Template::setValue( std::string name, std::string value ) {
-    valueByName[ name ] = std::make_shared<StringValue>( std::move(value) );
+    set( slot( name ), Value( std::move(value) ) );
     return *this;
 }
 
 Template&Template::setValue( std::string name, TupleValue value) {
-    valueByName[ name ] = std::make_shared<TupleValue>( std::move(value) );
+    set( slot( name ), Value( std::move(value) ) );
     return *this;
 
 }
-std::string Template::render() {
-    std::unique_ptr<Root> root(new Root());
-    size_t finalPos = eatSection(0, root.get() );
-    if( finalPos != sourceCode.length() ) {
-        throw render_error("some sourcecode found at end: " + sourceCode.substr( finalPos ) );
+Template &Template::setValue( std::string name, Value value ) {
+    set( slot( name ), std::move( value ) );
+    return *this;
+}
+void Template::set( int slot, Value value ) {
+    if( slot >= (int)values.size() ) {
+        values.resize( slot + 1 );
+    }
+    values[slot] = std::move( value );
+}
+// the slot for name, allocating a new one the first time name is seen
+int Template::slot( const std::string &name ) const {
+    std::map< std::string, int >::const_iterator it = slotByName.find( name );
+    if( it != slotByName.end() ) {
+        return it->second;
+    }
+    int newSlot = (int)slotByName.size();
+    slotByName[name] = newSlot;
+    slotKeys.push_back( MapKey( name ) );
+    return newSlot;
+}
+int Template::numSlots() const {
+    return (int)slotByName.size();
+}
+// which member of a reflected struct each slot refers to, or -1
+std::vector< int > Template::fieldSlots( const StructFields &fields ) const {
+    compile(); // interns every name the template uses
+    std::lock_guard<std::mutex> lock( compileMutex );
+    std::vector< int > fieldBySlot( slotByName.size(), -1 );
+    for( std::map< std::string, int >::const_iterator it = slotByName.begin(); it != slotByName.end(); it++ ) {
+        fieldBySlot[it->second] = fields.find( it->first );
+    }
+    return fieldBySlot;
+}
+// parses sourceCode, the first time it is called; safe to call from several
+// threads at once
+const Root &Template::compile() const {
+    Root *result = compiled.load( std::memory_order_acquire );
+    if( result != 0 ) {
+        return *result;
+    }
+    std::lock_guard<std::mutex> lock( compileMutex );
+    if( !root ) {
+        std::unique_ptr<Root> newRoot(new Root());
+        LoopScope scope;
+        size_t finalPos = eatSection(0, newRoot.get(), scope );
+        if( finalPos != sourceCode.length() ) {
+            throw render_error("some sourcecode found at end: " + sourceCode.substr( finalPos ) );
+        }
+        newRoot->numFrames = scope.maxDepth;
+        root = std::move( newRoot );
+        compiled.store( root.get(), std::memory_order_release );
+    }
+    return *root;
+}
+std::string Template::render() const {
+    StringOutput output( estimateSize() );
+    render( output );
+    return output.release();
+}
+void Template::render( Output &output ) const {
+    RenderContext context( *this );
+    render( context, output );
+}
+// names the template doesn't set itself are looked up in globals
+std::string Template::render( const Context &globals ) const {
+    StringOutput output( estimateSize() );
+    render( globals, output );
+    return output.release();
+}
+void Template::render( const Context &globals, Output &output ) const {
+    RenderContext context( *this, &globals );
+    render( context, output );
+}
+void Template::render( RenderContext &context, Output &output ) const {
+    const Root &compiledRoot = compile();
+    context.reset( compiledRoot.numFrames );
+    size_t startSize = output.size();
+    compiledRoot.render( context, output );
+    lastRenderSize.store( output.size() - startSize, std::memory_order_relaxed );
+}
+// the file is mapped at the estimated size up front, and truncated to the
+// rendered length once rendering finishes
+void Template::renderToFile( std::string filepath ) const {
+    FileOutput output( filepath, estimateSize() );
+    render( output );
+    output.close();
+}
+// how many bytes the next render will probably need: the previous render's
+// size if there was one, otherwise the size of the source
+size_t Template::estimateSize() const {
+    size_t lastSize = lastRenderSize.load( std::memory_order_relaxed );
+    if( lastSize > 0 ) {
+        return lastSize + lastSize / 8;
     }
-    return root->render(valueByName);
+    return sourceCode.length();
 }
 
 void Template::print(ControlSection *section) {
     section->print("");
 }
 
+// innermost loop variable called name, otherwise the value slot for name.
+// name can be followed by an access path, eg cfg.tile.x, cfg["k"] or items[0]
+VariableRef Template::resolve( const std::string &name, const LoopScope &scope ) const {
+    VariableRef ref;
+    ref.name = name;
+    size_t baseEnd = name.find_first_of( ".[" );
+    const string base = name.substr( 0, baseEnd );
+    if( base == "" ) {
+        throw render_error( "variable name expected: " + name );
+    }
+    size_t pos = baseEnd;
+    while( pos != string::npos && pos < name.length() ) {
+        string key;
+        bool quoted = false;
+        bool subscript = name[pos] == '[';
+        if( name[pos] == '.' ) {
+            size_t keyEnd = name.find_first_of( ".[", pos + 1 );
+            key = name.substr( pos + 1, keyEnd == string::npos ? string::npos : keyEnd - pos - 1 );
+            pos = keyEnd;
+        } else if( name[pos] == '[' ) {
+            size_t close = name.find( ']', pos );
+            if( close == string::npos ) {
+                throw render_error( "unterminated [ in " + name );
+            }
+            key = trim( name.substr( pos + 1, close - pos - 1 ) );
+            if( key.length() >= 2 && ( key[0] == '"' || key[0] == '\'' ) && key[key.length() - 1] == key[0] ) {
+                key = key.substr( 1, key.length() - 2 );
+                quoted = true;
+            }
+            pos = close + 1;
+        } else {
+            throw render_error( "unexpected " + name.substr( pos, 1 ) + " in " + name );
+        }
+        int index = -1;
+        if( !quoted && !isNumber( key, &index ) ) {
+            index = -1;
+            if( key == "" || subscript ) {
+                throw render_error( "key expected in " + name );
+            }
+        }
+        ref.path.push_back( PathStep( key, index ) );
+    }
+    for( int i = (int)scope.varNames.size() - 1; i >= 0; i-- ) {
+        if( scope.varNames[i] == base ) {
+            ref.frame = i;
+            scope.used[i] = true;
+            return ref;
+        }
+    }
+    ref.slot = slot( base );
+    return ref;
+}
+// expression has had its spaces removed
+std::unique_ptr< LoopSource > Template::parseLoopSource( const std::string &expression, const LoopScope &scope ) const {
+    std::unique_ptr< LoopSource > source( new LoopSource() );
+    source->expression = expression;
+    vector< string > arguments;
+    if( parseCall( expression, "reversed", &arguments ) ) {
+        if( arguments.size() != 1 ) {
+            throw render_error( "reversed takes one argument: " + expression );
+        }
+        source->kind = LoopSource::REVERSED;
+        source->operands.push_back( parseLoopSource( arguments[0], scope ) );
+    } else if( parseCall( expression, "enumerate", &arguments ) ) {
+        if( arguments.size() != 1 && arguments.size() != 2 ) {
+            throw render_error( "enumerate takes one or two arguments: " + expression );
+        }
+        source->kind = LoopSource::ENUMERATE;
+        source->operands.push_back( parseLoopSource( arguments[0], scope ) );
+        source->bounds.push_back( parseLoopBound( arguments.size() == 2 ? arguments[1] : "0", scope ) );
+    } else if( parseCall( expression, "range", &arguments ) ) {
+        if( arguments.size() > 3 ) {
+            throw render_error( "range takes one to three arguments: " + expression );
+        }
+        source->kind = LoopSource::RANGE;
+        source->bounds.push_back( parseLoopBound( arguments.size() == 1 ? "0" : arguments[0], scope ) );
+        source->bounds.push_back( parseLoopBound( arguments.size() == 1 ? arguments[0] : arguments[1], scope ) );
+        source->bounds.push_back( parseLoopBound( arguments.size() == 3 ? arguments[2] : "1", scope ) );
+    } else if( parseCall( expression, "zip", &arguments ) ) {
+        source->kind = LoopSource::ZIP;
+        for( size_t i = 0; i < arguments.size(); i++ ) {
+            source->operands.push_back( parseLoopSource( arguments[i], scope ) );
+        }
+    } else {
+        // a slice is the last [] in the expression, with a : in it
+        size_t open = string::npos;
+        if( expression.length() > 0 && expression[expression.length() - 1] == ']' ) {
+            int depth = 0;
+            for( size_t i = expression.length(); i-- > 0; ) {
+                depth += expression[i] == ']' ? 1 : expression[i] == '[' ? -1 : 0;
+                if( depth == 0 ) {
+                    open = i;
+                    break;
+                }
+            }
+        }
+        string subscript = open == string::npos ? "" : expression.substr( open + 1, expression.length() - open - 2 );
+        if( subscript.find( ':' ) == string::npos ) {
+            source->variable = resolve( expression, scope );
+            scope.noteRead( source->variable );
+            return source;
+        }
+        vector< string > parts = split( subscript, ":" );
+        if( parts.size() > 3 ) {
+            throw render_error( "slice expected in " + expression );
+        }
+        source->kind = LoopSource::SLICE;
+        source->operands.push_back( parseLoopSource( expression.substr( 0, open ), scope ) );
+        for( size_t i = 0; i < 3; i++ ) {
+            source->bounds.push_back( parseLoopBound( i < parts.size() ? parts[i] : "", scope ) );
+        }
+    }
+    return source;
+}
+// an empty bound is left out.  Anything but a number or a plain name is
+// compiled as an expression, eg range(n - 1) or items[i + 1:]
+LoopBound Template::parseLoopBound( const std::string &bound, const LoopScope &scope ) const {
+    LoopBound result;
+    if( bound == "" ) {
+        return result;
+    }
+    result.present = true;
+    int value = 0;
+    if( isNumber( bound, &value ) ) {
+        result.value = value;
+        return result;
+    }
+    std::unique_ptr< Expression > expression( new Expression() );
+    expression->compile( bound, *this, scope );
+    if( expression->isVariable() ) {
+        result.variable = expression->variables[0];
+    } else {
+        result.expression = std::move( expression );
+    }
+    return result;
+}
+// the condition of {% for x in items if condition %}, or 0 if filter is empty
+std::unique_ptr< Expression > Template::compileFilter( const std::string &filter, const LoopScope &scope ) const {
+    std::unique_ptr< Expression > expression;
+    if( filter != "" ) {
+        expression.reset( new Expression() );
+        expression->compile( filter, *this, scope );
+    }
+    return expression;
+}
+// if expression is name( ... ), splits the arguments at top level commas
+STATIC bool Template::parseCall( const std::string &expression, const std::string &name, std::vector< std::string > *p_arguments ) {
+    if( expression.compare( 0, name.length() + 1, name + "(" ) != 0 || expression[expression.length() - 1] != ')' ) {
+        return false;
+    }
+    p_arguments->clear();
+    int depth = 0;
+    string current = "";
+    for( size_t i = name.length() + 1; i < expression.length() - 1; i++ ) {
+        char c = expression[i];
+        depth += ( c == '(' || c == '[' ) ? 1 : ( c == ')' || c == ']' ) ? -1 : 0;
+        if( c == ',' && depth == 0 ) {
+            p_arguments->push_back( current );
+            current = "";
+        } else {
+            current += c;
+        }
+    }
+    p_arguments->push_back( current );
+    for( size_t i = 0; i < p_arguments->size(); i++ ) {
+        if( ( *p_arguments )[i] == "" ) {
+            throw render_error( "argument expected in " + expression );
+        }
+    }
+    return true;
+}
 // pos should point to the first character that has sourcecode inside the control section controlSection
 // return value should be first character of the control section end part (ie first char of {% endfor %} type bit)
-int Template::eatSection( int pos, ControlSection *controlSection ) {
+int Template::eatSection( int pos, ControlSection *controlSection, LoopScope &scope ) const {
 //    int pos = 0;
 //    vector<string> tokenStack;
 //    string updatedString = "";
@@ -94,6 +365,7 @@ int Template::eatSection( int pos, ControlSection *controlSection ) {
             code->endPos = sourceCode.length();
 //            code->templateCode = sourceCode.substr( pos, sourceCode.length() - pos );
             code->templateCode = sourceCode.substr( code->startPos, code->endPos - code->startPos );
+            code->compile( *this, scope );
             controlSection->sections.push_back( std::move(code) );
             return sourceCode.length();
         } else {
@@ -103,14 +375,15 @@ int Template::eatSection( int pos, ControlSection *controlSection ) {
             }
             string controlChange = trim( sourceCode.substr( controlChangeBegin + 2, controlChangeEnd - controlChangeBegin - 2 ) );
             vector<string> splitControlChange = split( controlChange, " " );
-            if( splitControlChange[0] == "endfor" || splitControlChange[0] == "endif") {
-                if( splitControlChange.size() != 1 ) {
+            if( splitControlChange[0] == "endfor" || splitControlChange[0] == "endif" || splitControlChange[0] == "else" || splitControlChange[0] == "elif" ) {
+                if( splitControlChange.size() != 1 && splitControlChange[0] != "elif" ) {
                     throw render_error("control section {% " + controlChange + " unrecognized" );
                 }
                 std::unique_ptr<Code> code(new Code());
                 code->startPos = pos;
                 code->endPos = controlChangeBegin;
                 code->templateCode = sourceCode.substr( code->startPos, code->endPos - code->startPos );
+                code->compile( *this, scope );
                 controlSection->sections.push_back( std::move(code) );
                 return controlChangeBegin;
 //                if( tokenStack.size() == 0 ) {
@@ -130,45 +403,84 @@ int Template::eatSection( int pos, ControlSection *controlSection ) {
                 code->startPos = pos;
                 code->endPos = controlChangeBegin;
                 code->templateCode = sourceCode.substr( code->startPos, code->endPos - code->startPos );
+                code->compile( *this, scope );
                 controlSection->sections.push_back( std::move(code) );
 
-                string varname = splitControlChange[1];
-                if( splitControlChange[2] != "in" ) {
+                // the loop variable, or names to unpack each element into,
+                // eg a, b or (a, b)
+                int inIndex = 2;
+                while( inIndex < (int)splitControlChange.size() && splitControlChange[inIndex] != "in" ) {
+                    inIndex++;
+                }
+                if( inIndex >= (int)splitControlChange.size() ) {
+                    throw render_error("control section {% " + controlChange + " unexpected: second word should be 'in'" );
+                }
+                string varname = "";
+                for( int i = 1; i < inIndex; i++ ) {
+                    varname += splitControlChange[i];
+                }
+                vector<string> unpackNames;
+                if( varname.find( ',' ) != string::npos ) {
+                    string names = varname;
+                    if( names[0] == '(' && names[names.length() - 1] == ')' ) {
+                        names = names.substr( 1, names.length() - 2 );
+                    }
+                    unpackNames = split( names, "," );
+                    for( int i = 0; i < (int)unpackNames.size(); i++ ) {
+                        if( unpackNames[i] == "" ) {
+                            throw render_error("control section {% " + controlChange + " unexpected: name expected before 'in'" );
+                        }
+                    }
+                } else if( inIndex != 2 ) {
                     throw render_error("control section {% " + controlChange + " unexpected: second word should be 'in'" );
                 }
+                // anything after an if is a filter: {% for x in items if x > 2 %}
                 string rangeString = "";
-                for( int i = 3; i < (int)splitControlChange.size(); i++ ) {
-                    rangeString += splitControlChange[i];
+                string filterString = "";
+                int filterIndex = inIndex + 1;
+                while( filterIndex < (int)splitControlChange.size() && splitControlChange[filterIndex] != "if" ) {
+                    rangeString += splitControlChange[filterIndex++];
+                }
+                for( int i = filterIndex + 1; i < (int)splitControlChange.size(); i++ ) {
+                    filterString += ( i > filterIndex + 1 ? " " : "" ) + splitControlChange[i];
+                }
+                if( filterIndex < (int)splitControlChange.size() && trim( filterString ) == "" ) {
+                    throw render_error("control section {% " + controlChange + " unexpected: condition expected after 'if'" );
                 }
                 rangeString = replaceGlobal( rangeString, " ", "" );
                 vector<string> splitRangeString = split( rangeString, "(" );
                 if( splitRangeString[0] == "range" ) {
-                    if( splitRangeString.size() != 2 ) {
-                        throw render_error("control section " + controlChange + " unexpected: should be in format 'range(somevar)' or 'range(somenumber)'" );
+                    if( !unpackNames.empty() ) {
+                        throw render_error("control section " + controlChange + " unexpected: range elements cannot be unpacked" );
                     }
-                    string name = split( splitRangeString[1], ")" )[0];
-    //                cout << "for range name: " << name << endl;
-                    int endValue;
-                    if( isNumber( name, &endValue ) ) {
-                    } else {
-                        if( valueByName.find( name ) != valueByName.end() ) {
-                            IntValue *intValue = dynamic_cast< IntValue * >( valueByName[ name ].get() );
-                            if( intValue == 0 ) {
-                                throw render_error("for loop range var " + name + " must be an int (but it's not)");
-                            }
-                            endValue = intValue->value;
-                        } else {
-                            throw render_error("for loop range var " + name + " not recognized");
-                        }                    
+                    vector<string> rangeArguments;
+                    if( !parseCall( rangeString, "range", &rangeArguments ) || rangeArguments.size() > 3 ) {
+                        throw render_error("control section " + controlChange + " unexpected: should be in format 'range(stop)', 'range(start, stop)' or 'range(start, stop, step)'" );
                     }
-                    int beginValue = 0; // default for now...
-    //                cout << "for loop start=" << beginValue << " end=" << endValue << endl;
                     std::unique_ptr<ForRangeSection> forSection(new ForRangeSection());
                     forSection->startPos = controlChangeEnd + 2;
-                    forSection->loopStart = beginValue;
-                    forSection->loopEnd = endValue;
+                    // literals, or names looked up when the loop is rendered
+                    if( rangeArguments.size() == 1 ) {
+                        forSection->stop = parseLoopBound( rangeArguments[0], scope );
+                    } else {
+                        forSection->start = parseLoopBound( rangeArguments[0], scope );
+                        forSection->stop = parseLoopBound( rangeArguments[1], scope );
+                        if( rangeArguments.size() == 3 ) {
+                            forSection->step = parseLoopBound( rangeArguments[2], scope );
+                        }
+                    }
                     forSection->varName = varname;
-                    pos = eatSection( controlChangeEnd + 2, forSection.get() );
+                    forSection->frame = scope.push( varname );
+                    forSection->filter = compileFilter( filterString, scope );
+                    int loopInfoFrame = scope.push( "loop" );
+                    pos = eatSection( controlChangeEnd + 2, forSection.get(), scope );
+                    forSection->loopInfoFrame = scope.used[loopInfoFrame] ? loopInfoFrame : -1;
+                    forSection->countFirst = forSection->filter && scope.needsLength[loopInfoFrame];
+                    scope.pop();
+                    scope.pop();
+                    if( !forSection->filter ) {
+                        forSection->kernel = LoopKernel::build( *forSection, forSection->frame );
+                    }
                     size_t controlEndEndPos = sourceCode.find("%}", pos );
                     if( controlEndEndPos == string::npos ) {
                         throw render_error("No control end section found at: " + sourceCode.substr(pos ) );
@@ -183,19 +495,32 @@ int Template::eatSection( int pos, ControlSection *controlSection ) {
                     pos = controlEndEndPos + 2;
                 } else {
                     const std::string name = rangeString;
-                    if (valueByName.find( name ) != valueByName.end() ) {
-                        TupleValue *value = dynamic_cast< TupleValue * >( valueByName[ name ].get() );
-                        if( value == 0 ) {
-                            throw render_error("for loop var " + name + " must be a range or a vector (but it's neither)");
-                        }
-                    } else {
-                        throw render_error("for loop var " + name + " not recognized");
-                    }
                     std::unique_ptr<ForSection> forSection(new ForSection());
-                    forSection->varName = varname;
                     forSection->tupVarName = name;
-                    
-                    pos = eatSection( controlChangeEnd + 2, forSection.get() );
+                    forSection->source = parseLoopSource( name, scope );
+                    forSection->varName = varname;
+                    if( unpackNames.empty() ) {
+                        forSection->frame = scope.push( varname );
+                    } else {
+                        forSection->frame = -1;
+                        for( int i = 0; i < (int)unpackNames.size(); i++ ) {
+                            forSection->unpackFrames.push_back( scope.push( unpackNames[i] ) );
+                        }
+                    }
+                    forSection->filter = compileFilter( filterString, scope );
+                    int loopInfoFrame = scope.push( "loop" );
+
+                    pos = eatSection( controlChangeEnd + 2, forSection.get(), scope );
+                    forSection->loopInfoFrame = scope.used[loopInfoFrame] ? loopInfoFrame : -1;
+                    forSection->countFirst = forSection->filter && scope.needsLength[loopInfoFrame];
+                    scope.pop();
+                    size_t numNames = unpackNames.empty() ? 1 : unpackNames.size();
+                    for( size_t i = 0; i < numNames; i++ ) {
+                        scope.pop();
+                    }
+                    if( !forSection->filter && forSection->frame >= 0 ) {
+                        forSection->kernel = LoopKernel::build( *forSection, forSection->frame );
+                    }
                     controlSection->sections.push_back(std::move(forSection));
                     size_t controlEndEndPos = sourceCode.find("%}", pos );
                     if( controlEndEndPos == string::npos ) {
@@ -208,39 +533,61 @@ int Template::eatSection( int pos, ControlSection *controlSection ) {
                     }
                     pos = controlEndEndPos + 2;
                 }
+            } else if( splitControlChange[0] == "break" || splitControlChange[0] == "continue" ) {
+                if( splitControlChange.size() != 1 ) {
+                    throw render_error("control section {% " + controlChange + " unrecognized" );
+                }
+                if( scope.varNames.empty() ) {
+                    throw render_error("control section {% " + controlChange + " %} is only allowed inside a for loop" );
+                }
+                std::unique_ptr<Code> code(new Code());
+                code->startPos = pos;
+                code->endPos = controlChangeBegin;
+                code->templateCode = sourceCode.substr( code->startPos, code->endPos - code->startPos );
+                code->compile( *this, scope );
+                controlSection->sections.push_back( std::move(code) );
+                std::unique_ptr<LoopControlSection> loopControl(new LoopControlSection());
+                loopControl->control = splitControlChange[0] == "break" ? RenderContext::BREAK : RenderContext::CONTINUE;
+                controlSection->sections.push_back( std::move(loopControl) );
+                pos = controlChangeEnd + 2;
             } else if (splitControlChange[0] == "if") {
                 std::unique_ptr<Code> code(new Code());
                 code->startPos = pos;
                 code->endPos = controlChangeBegin;
                 code->templateCode = sourceCode.substr(code->startPos, code->endPos - code->startPos);
+                code->compile( *this, scope );
                 controlSection->sections.push_back(std::move(code));
-                const string word = splitControlChange[1];
-                if (JINJA2_TRUE == word)  {
-                    ;
-                } else if (JINJA2_FALSE == word) {
-                    ;
-                }
-                else if (JINJA2_NOT == word) {
-                    ;
-                }
-                else {
-                    ;
-                }
-                std::unique_ptr<IfSection> ifSection(new IfSection(controlChange));
+                std::unique_ptr<IfSection> ifSection(new IfSection(controlChange, *this, scope));
 
-                pos = eatSection(controlChangeEnd + 2, ifSection.get());
-                controlSection->sections.push_back(std::move(ifSection));
-                size_t controlEndEndPos = sourceCode.find("%}", pos);
-                if (controlEndEndPos == string::npos) {
-                    throw render_error("No control end of any section found at: " + sourceCode.substr(pos));
-                }
-                string controlEnd = sourceCode.substr(pos, controlEndEndPos - pos + 2);
-                string controlEndNorm = replaceGlobal(controlEnd, " ", "");
-                if (controlEndNorm != "{%endif%}") {
-                    throw render_error("No control end section found, expected '{% endif %}', got '" + controlEnd + "'");
+                // one body per branch, each ending at the next elif, else or endif
+                size_t bodyStart = controlChangeEnd + 2;
+                while (true) {
+                    std::unique_ptr<Container> body(new Container());
+                    body->sourceCodePosStart = bodyStart;
+                    pos = eatSection(bodyStart, body.get(), scope);
+                    body->sourceCodePosEnd = pos;
+                    ifSection->sections.push_back(std::move(body));
+                    size_t controlEndEndPos = sourceCode.find("%}", pos);
+                    if (controlEndEndPos == string::npos) {
+                        throw render_error("No control end of any section found at: " + sourceCode.substr(pos));
+                    }
+                    string controlEnd = sourceCode.substr(pos, controlEndEndPos - pos + 2);
+                    string controlEndNorm = replaceGlobal(controlEnd, " ", "");
+                    string nextControl = trim(sourceCode.substr(pos + 2, controlEndEndPos - pos - 2));
+                    pos = controlEndEndPos + 2;
+                    bodyStart = pos;
+                    if (controlEndNorm == "{%endif%}") {
+                        break;
+                    } else if (controlEndNorm == "{%else%}" && !ifSection->hasElse()) {
+                        ;
+                    } else if (split(nextControl, " ")[0] == "elif" && !ifSection->hasElse()) {
+                        ifSection->addCondition(nextControl, *this, scope);
+                    } else {
+                        throw render_error("No control end section found, expected '{% endif %}', got '" + controlEnd + "'");
+                    }
                 }
-                //forSection->endPos = controlEndEndPos + 2;
-                pos = controlEndEndPos + 2;
+                ifSection->buildTable();
+                controlSection->sections.push_back(std::move(ifSection));
 
             } else {
                 throw render_error("control section {% " + controlChange + " unexpected" );
@@ -265,76 +612,359 @@ int Template::eatSection( int pos, ControlSection *controlSection ) {
 ////    string templatedString = doSubstitutions( sourceCode, valueByName );
 //    return updatedString;
 }
-STATIC std::string Template::doSubstitutions( std::string sourceCode, const ValueMap &valueByName ) {
-    int startI = 1;
-    if( sourceCode.substr(0,2) == "{{" ) {
-        startI = 0;
+// applies path to value, one step at a time; 0 if any step is missing
+const Value *RenderContext::followPath( const Value *value, const std::vector< PathStep > &path, Value &scratch ) {
+    Value temp[2];
+    int nextTemp = 0;
+    for( size_t i = 0; i < path.size(); i++ ) {
+        const PathStep &step = path[i];
+        Value &stepScratch = temp[nextTemp];
+        const Value *next = 0;
+        if( value->type() == Value::SEQUENCE && step.index >= 0 ) {
+            const Sequence &sequence = value->asSequence();
+            if( (size_t)step.index < sequence.size() ) {
+                next = sequence.at( step.index, stepScratch );
+            }
+        } else if( value->type() == Value::MAP ) {
+            next = value->asMap().get( step.key, stepScratch );
+        }
+        if( next == 0 ) {
+            return 0;
+        }
+        if( next->type() == Value::LAZY ) {
+            // the container might be a loop variable, or refilled in place,
+            // so the element's address says nothing about what it holds
+            next = compute( *next, stepScratch );
+            if( next == 0 ) {
+                return 0;
+            }
+        }
+        if( next == &stepScratch ) {
+            nextTemp ^= 1;
+        }
+        value = next;
     }
-    string templatedString = "";
-    vector<string> splitSource = split( sourceCode, "{{" );
-    if( startI == 1 ) {
-        templatedString = splitSource[0];
+    if( value == &temp[0] || value == &temp[1] ) {
+        scratch = std::move( *const_cast< Value * >( value ) );
+        return &scratch;
     }
-    for( size_t i = startI; i < splitSource.size(); i++ ) {
-        if (0 == i && splitSource.size() > 1 && splitSource[i].empty()) // Ignoring initial empty section if there are other sections.
-        {
+    return value;
+}
+const Value *RenderContext::compute( const Value &lazy, Value &scratch ) {
+    Value computed = lazy.asLazy().compute();
+    scratch = std::move( computed );
+    return scratch.type() == Value::NONE ? 0 : &scratch;
+}
+
+namespace {
+    const char *const LOOP_ATTRIBUTES[] = { "index", "index0", "revindex", "revindex0", "first", "last", "length" };
+    const size_t NUM_LOOP_ATTRIBUTES = sizeof( LOOP_ATTRIBUTES ) / sizeof( LOOP_ATTRIBUTES[0] );
+}
+size_t LoopInfo::size() const {
+    return NUM_LOOP_ATTRIBUTES;
+}
+// key.hint remembers which attribute key named last time
+const Value *LoopInfo::get( const MapKey &key, Value &scratch ) const {
+    size_t attribute = key.hint.load( std::memory_order_relaxed );
+    if( attribute >= NUM_LOOP_ATTRIBUTES || key.name != LOOP_ATTRIBUTES[attribute] ) {
+        attribute = 0;
+        while( attribute < NUM_LOOP_ATTRIBUTES && key.name != LOOP_ATTRIBUTES[attribute] ) {
+            attribute++;
+        }
+        if( attribute == NUM_LOOP_ATTRIBUTES ) {
+            return 0;
+        }
+        key.hint.store( attribute, std::memory_order_relaxed );
+    }
+    if( attribute >= 2 && attribute != 4 && length < 0 ) {
+        throw render_error( string( "loop." ) + LOOP_ATTRIBUTES[attribute] + " needs the number of iterations, which isn't known in advance for an iterable" );
+    }
+    switch( attribute ) {
+        case 0:
+            scratch.setInt( index0 + 1 );
+            break;
+        case 1:
+            scratch.setInt( index0 );
+            break;
+        case 2:
+            scratch.setInt( length - index0 );
+            break;
+        case 3:
+            scratch.setInt( length - index0 - 1 );
+            break;
+        case 4:
+            scratch.setBool( index0 == 0 );
+            break;
+        case 5:
+            scratch.setBool( index0 == length - 1 );
+            break;
+        default:
+            scratch.setInt( length );
+    }
+    return &scratch;
+}
+// the attributes that are known
+void LoopInfo::render( Output &output ) const {
+    Value scratch;
+    output.write( "{", 1 );
+    for( size_t i = 0; i < NUM_LOOP_ATTRIBUTES; i++ ) {
+        if( length < 0 && i >= 2 && i != 4 ) {
             continue;
         }
+        if( i > 0 ) {
+            output.write( ", ", 2 );
+        }
+        output.write( LOOP_ATTRIBUTES[i], strlen( LOOP_ATTRIBUTES[i] ) );
+        output.write( ": ", 2 );
+        get( MapKey( LOOP_ATTRIBUTES[i] ), scratch )->render( output );
+    }
+    output.write( "}", 1 );
+}
 
-        vector<string> thisSplit = split( splitSource[i], "}}" );
-        string name = trim( thisSplit[0] );
-//        cout << "name: " << name << endl;
-        auto p = valueByName.find( name );
-        if( p == valueByName.end() ) {
-            throw render_error( "name " + name + " not defined" );
+int64_t LoopBound::evaluate( RenderContext &context ) const {
+    if( !present ) {
+        return SLICE_DEFAULT;
+    }
+    if( expression ) {
+        const Value *result = expression->evaluate( context );
+        if( result->type() != Value::INT ) {
+            throw render_error( expression->source + " must be an int (but it's not)" );
         }
-        auto value = p->second;
-        templatedString += value->render();
-        if( thisSplit.size() > 0 ) {
-            templatedString += thisSplit[1];
+        return result->asInt();
+    }
+    if( variable.name.empty() ) {
+        return value;
+    }
+    Value scratch;
+    const Value *found = context.lookup( variable, scratch );
+    if( found == 0 ) {
+        throw render_error( "name " + variable.name + " not defined" );
+    }
+    if( found->type() != Value::INT ) {
+        throw render_error( variable.name + " must be an int (but it's not)" );
+    }
+    return found->asInt();
+}
+const Value *LoopSource::evaluate( RenderContext &context, Value &storage ) const {
+    if( kind == VARIABLE ) {
+        const Value *value = context.lookup( variable, storage );
+        if( value == 0 ) {
+            throw render_error("for loop var " + expression + " not recognized");
         }
+        return value;
+    }
+    std::vector< Value > operandValues( operands.size() );
+    for( size_t i = 0; i < operands.size(); i++ ) {
+        Value operandStorage;
+        operandValues[i] = *operands[i]->evaluate( context, operandStorage );
     }
-    return templatedString;
+    switch( kind ) {
+        case SLICE:
+            storage = sliceView( operandValues[0], bounds[0].evaluate( context ), bounds[1].evaluate( context ),
+                bounds[2].evaluate( context ) );
+            break;
+        case REVERSED:
+            storage = reversedView( operandValues[0] );
+            break;
+        case ENUMERATE:
+            storage = enumerateView( operandValues[0], bounds[0].evaluate( context ) );
+            break;
+        case RANGE:
+            storage = rangeView( bounds[0].evaluate( context ), bounds[1].evaluate( context ), bounds[2].evaluate( context ) );
+            break;
+        default:
+            storage = zipView( operandValues );
+    }
+    return &storage;
 }
 
-void IfSection::parseIfCondition(const std::string& expression) {
+std::unique_ptr< LoopKernel > LoopKernel::build( const ControlSection &body, int frame ) {
+    std::unique_ptr< LoopKernel > kernel( new LoopKernel() );
+    kernel->pieces.push_back( "" );
+    for( size_t i = 0; i < body.sections.size(); i++ ) {
+        const Code *code = dynamic_cast< const Code * >( body.sections[i].get() );
+        if( code == 0 ) {
+            return std::unique_ptr< LoopKernel >();
+        }
+        kernel->pieces.back() += code->literals[0];
+        for( size_t j = 0; j < code->vars.size(); j++ ) {
+            const VariableRef &var = code->vars[j];
+            if( code->expressions[j] || var.frame != frame || !var.path.empty() ) {
+                return std::unique_ptr< LoopKernel >();
+            }
+            kernel->pieces.push_back( code->literals[j + 1] );
+        }
+    }
+    kernel->piecesLength = 0;
+    for( size_t i = 0; i < kernel->pieces.size(); i++ ) {
+        kernel->piecesLength += kernel->pieces[i].size();
+    }
+    return kernel;
+}
+void LoopKernel::render( int64_t begin, int64_t end, int64_t step, Output &output ) const {
+    const size_t count = rangeLength( begin, end, step );
+    if( count == 0 ) {
+        return;
+    }
+    if( pieces.size() == 1 ) {
+        repeatLiteral( count, output );
+        return;
+    }
+    // batches of about 64KB, so each needs one bounds check on the output
+    const size_t iterationLength = piecesLength + ( pieces.size() - 1 ) * MAX_NUMBER_LENGTH;
+    const size_t batchSize = iterationLength < 65536 ? 65536 / iterationLength : 1;
+    const bool counting = step == 1 && begin >= 0;
+    DecimalCounter counter( counting ? begin : 0 );
+    char formatted[MAX_NUMBER_LENGTH];
+    int64_t index = begin;
+    for( size_t done = 0; done < count; ) {
+        const size_t batchEnd = count - done < batchSize ? count : done + batchSize;
+        char *out = output.reserveSpace( ( batchEnd - done ) * iterationLength );
+        for( ; done < batchEnd; done++ ) {
+            const char *digits = formatted;
+            size_t digitsLength;
+            if( counting ) {
+                digits = counter.data();
+                digitsLength = counter.size();
+            } else {
+                digitsLength = formatInt( index, formatted ) - formatted;
+                index += step;
+            }
+            memcpy( out, pieces[0].data(), pieces[0].size() );
+            out += pieces[0].size();
+            for( size_t i = 1; i < pieces.size(); i++ ) {
+                memcpy( out, digits, digitsLength );
+                out += digitsLength;
+                memcpy( out, pieces[i].data(), pieces[i].size() );
+                out += pieces[i].size();
+            }
+            if( counting ) {
+                counter.increment();
+            }
+        }
+        output.advance( out );
+    }
+}
+// the text is written once, then copied onto the end of itself, doubling
+// what's there each time
+void LoopKernel::repeatLiteral( size_t count, Output &output ) const {
+    const size_t total = count * piecesLength;
+    if( total == 0 ) {
+        return;
+    }
+    char *out = output.reserveSpace( total );
+    memcpy( out, pieces[0].data(), piecesLength );
+    for( size_t written = piecesLength; written < total; ) {
+        const size_t length = written < total - written ? written : total - written;
+        memcpy( out + written, out, length );
+        written += length;
+    }
+    output.advance( out + total );
+}
+void Code::compile( const Template &thetemplate, const LoopScope &scope ) {
+    literals.clear();
+    vars.clear();
+    expressions.clear();
+    size_t pos = templateCode.find( "{{" );
+    literals.push_back( templateCode.substr( 0, pos ) );
+    while( pos != string::npos ) {
+        size_t nameEnd = templateCode.find( "}}", pos + 2 );
+        if( nameEnd == string::npos ) {
+            throw render_error( "substitution unterminated: " + templateCode.substr( pos, 40 ) );
+        }
+        std::unique_ptr< Expression > expression( new Expression() );
+        expression->compile( trim( templateCode.substr( pos + 2, nameEnd - pos - 2 ) ), thetemplate, scope );
+        if( expression->isVariable() ) {
+            vars.push_back( expression->variables[0] );
+            expression.reset();
+        } else {
+            vars.push_back( VariableRef() );
+            vars.back().name = expression->source;
+        }
+        expressions.push_back( std::move( expression ) );
+        pos = templateCode.find( "{{", nameEnd + 2 );
+        literals.push_back( templateCode.substr( nameEnd + 2, pos == string::npos ? string::npos : pos - nameEnd - 2 ) );
+    }
+}
+
+void IfSection::addCondition(const std::string& expression, const Template &thetemplate, const LoopScope &scope) {
     const std::vector<std::string> splittedExpression = split(expression, " ");
-    if (splittedExpression.empty() || splittedExpression[0] != "if") {
+    if (splittedExpression.empty() || (splittedExpression[0] != "if" && splittedExpression[0] != "elif")) {
         throw render_error("if statement expected.");
     }
+    const std::string &keyword = splittedExpression[0];
+    const std::string condition = trim(expression.substr(keyword.length()));
+    if (condition == "") {
+        throw render_error("Any expression expected after " + keyword + " statement.");
+    }
+    if (condition == JINJA2_NOT) {
+        throw render_error("Any expression expected after " + keyword + " not statement.");
+    }
+    m_conditions.push_back(Expression());
+    m_conditions.back().compile(condition, thetemplate, scope);
+}
 
-    std::size_t expressionIndex = 1;
-    if (splittedExpression.size() < expressionIndex + 1) {
-        throw render_error("Any expression expected after if statement.");
+// worth it for three or more branches, when the ints don't leave too many
+// gaps between them
+void IfSection::buildTable() {
+    m_table.clear();
+    if (m_conditions.size() < 3) {
+        return;
+    }
+    std::vector<int64_t> keys;
+    const VariableRef *first = 0;
+    for (size_t i = 0; i < m_conditions.size(); i++) {
+        const VariableRef *variable = 0;
+        int64_t key = 0;
+        if (!m_conditions[i].isIntEquality(&variable, &key)) {
+            return;
+        }
+        if (first != 0 && (variable->name != first->name || variable->frame != first->frame || variable->slot != first->slot)) {
+            return;
+        }
+        first = variable;
+        keys.push_back(key);
+    }
+    int64_t lowest = keys[0];
+    int64_t highest = keys[0];
+    for (size_t i = 1; i < keys.size(); i++) {
+        lowest = keys[i] < lowest ? keys[i] : lowest;
+        highest = keys[i] > highest ? keys[i] : highest;
     }
-    m_isNegation = (JINJA2_NOT == splittedExpression[expressionIndex]);
-    expressionIndex += (m_isNegation) ? 1 : 0;
-    if (splittedExpression.size() < expressionIndex + 1) {
-        if (!m_isNegation)
-            throw render_error("Any expression expected after if statement.");
-        else
-            throw render_error("Any expression expected after if not statement.");
+    const uint64_t span = (uint64_t)highest - (uint64_t)lowest + 1;
+    if (span == 0 || span > 4 * keys.size()) {
+        return;
     }
-    m_variableName = splittedExpression[expressionIndex];
-    if (splittedExpression.size() > expressionIndex + 1) {
-        throw render_error(std::string("Unexpected expression after variable name: ") + splittedExpression[expressionIndex + 1]);
+    m_switchVariable = *first;
+    m_tableBase = lowest;
+    m_table.assign((size_t)span, -1);
+    for (size_t i = 0; i < keys.size(); i++) {
+        int &entry = m_table[(size_t)(keys[i] - lowest)];
+        if (entry < 0) {
+            entry = (int)i; // the first of several equal conditions wins
+        }
     }
 }
 
-bool IfSection::computeExpression(const ValueMap &valueByName) const {
-    if (JINJA2_TRUE == m_variableName) {
-        return true ^ m_isNegation;
-    }
-    else if (JINJA2_FALSE == m_variableName) {
-        return false ^ m_isNegation;
+// the table only answers for ints; anything else, eg 2.0, which == 2, goes
+// through the conditions one by one
+int IfSection::chooseBranch(RenderContext &context) const {
+    const int elseBranch = hasElse() ? (int)m_conditions.size() : -1;
+    if (!m_table.empty()) {
+        Value scratch;
+        const Value *value = context.lookup(m_switchVariable, scratch);
+        if (value != 0 && value->type() == Value::INT) {
+            const uint64_t entry = (uint64_t)value->asInt() - (uint64_t)m_tableBase;
+            const int branch = entry < m_table.size() ? m_table[(size_t)entry] : -1;
+            return branch >= 0 ? branch : elseBranch;
+        }
     }
-    else {
-        const bool valueExists = valueByName.count(m_variableName) > 0;
-        if (!valueExists) {
-            return false ^ m_isNegation;
+    for (size_t i = 0; i < m_conditions.size(); i++) {
+        if (m_conditions[i].evaluate(context)->isTrue()) {
+            return (int)i;
         }
-        return valueByName.at(m_variableName)->isTrue() ^ m_isNegation;
     }
+    return elseBranch;
 }
 
 }
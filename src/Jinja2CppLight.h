@@ -11,6 +11,9 @@
 // for now, will handle:
 // - variable substitution, ie {{myvar}}
 // - for loops, ie {% for i in range(myvar) %}
+//
+// render() returns a std::string; render( output ) and renderToFile() write
+// into an Output instead, see Output.h
 
 #pragma once
 
@@ -21,156 +24,375 @@
 #include <stdexcept>
 #include <sstream>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 #include "stringhelper.h"
+#include "Output.h"
+#include "Value.h"
+#include "Context.h"
+#include "Reflect.h"
+#include "SequenceViews.h"
+#include "Expression.h"
 
 #define VIRTUAL virtual
 #define STATIC static
 
 namespace Jinja2CppLight {
 
-class render_error : public std::runtime_error {
-public:
-    render_error( const std::string &what ) :
-        std::runtime_error( what ) {
-    }
-};
+extern const std::string JINJA2_TRUE;
+extern const std::string JINJA2_FALSE;
 
-class Value {
-public:
-    virtual ~Value() {}
-    virtual std::string render() = 0;
-    virtual bool isTrue() const = 0;
-};
-class IntValue : public Value {
+class Root;
+class ControlSection;
+class RenderContext;
+class LoopSource;
+class LoopBound;
+template< typename T > class ValueHandle;
+template< typename T > class StructBinding;
+
+// what Template::bind< T > starts a slot off as: T(), except that a C string
+// starts off empty rather than null
+template< typename T >
+inline Value boundDefault() {
+    return Value( T() );
+}
+template<>
+inline Value boundDefault< const char * >() {
+    return Value( "" );
+}
+template<>
+inline Value boundDefault< char * >() {
+    return Value( "" );
+}
+
+// variable names are interned into integer slots, by setValue and by the
+// compiler, so rendering indexes flat arrays and never compares strings
+//
+// the source is compiled on the first render, and the compiled form is never
+// modified afterwards: render() is const, and all per-render state lives in a
+// RenderContext, so one Template can be rendered from many threads at once,
+// as long as nobody calls setValue at the same time
+class Template {
 public:
-    int value;
-    IntValue( int value ) :
-        value( value ) {
+    std::string sourceCode;
+
+    std::vector< Value > values; // by slot; NONE if not set
+
+    // [[[cog
+    // import cog_addheaders
+    // cog_addheaders.add(classname='Template')
+    // ]]]
+    // generated, using cog:
+    Template( std::string sourceCode );
+    STATIC bool isNumber( std::string astring, int *p_value );
+    VIRTUAL ~Template();
+    Template &setValue( std::string name, int value );
+    Template &setValue( std::string name, float value );
+    Template &setValue( std::string name, double value );
+    Template &setValue( std::string name, const char *value );
+    Template &setValue( std::string name, std::string value );
+    Template&setValue( std::string name, TupleValue value);
+    Template &setValue( std::string name, Value value );
+    void set( int slot, Value value );
+    int slot( const std::string &name ) const;
+    int numSlots() const;
+    std::vector< int > fieldSlots( const StructFields &fields ) const;
+    const Root &compile() const;
+    std::string render() const;
+    void render( Output &output ) const;
+    std::string render( const Context &globals ) const;
+    void render( const Context &globals, Output &output ) const;
+    void render( RenderContext &context, Output &output ) const;
+    void renderToFile( std::string filepath ) const;
+    size_t estimateSize() const;
+    void print(ControlSection *section);
+    VariableRef resolve( const std::string &name, const LoopScope &scope ) const;
+    std::unique_ptr< LoopSource > parseLoopSource( const std::string &expression, const LoopScope &scope ) const;
+    LoopBound parseLoopBound( const std::string &bound, const LoopScope &scope ) const;
+    std::unique_ptr< Expression > compileFilter( const std::string &filter, const LoopScope &scope ) const;
+    STATIC bool parseCall( const std::string &expression, const std::string &name, std::vector< std::string > *p_arguments );
+    int eatSection( int pos, ControlSection *controlSection, LoopScope &scope ) const;
+
+    // [[[end]]]
+
+    // for values that change from one render to the next:
+    //     ValueHandle<int> its = mytemplate.bind<int>( "its" );
+    //     its.set( 42 );
+    // set() writes straight into the value's slot, without a name lookup
+    // views values, without copying them: values must stay alive, and
+    // unchanged, until rendering is finished.  An rvalue is moved in instead
+    template< typename T >
+    Template &setValue( std::string name, const std::vector< T > &values ) {
+        set( slot( name ), Value::view( values ) );
+        return *this;
     }
-    virtual std::string render() {
-        return toString( value );
+    template< typename T >
+    Template &setValue( std::string name, std::vector< T > &&values ) {
+        set( slot( name ), Value::own( std::move( values ) ) );
+        return *this;
     }
-    bool isTrue() const {
-        return value != 0;
+
+    template< typename T >
+    ValueHandle< T > bind( const std::string &name ) {
+        int boundSlot = slot( name );
+        set( boundSlot, boundDefault< T >() );
+        return ValueHandle< T >( this, boundSlot );
     }
-};
-class FloatValue : public Value {
-public:
-    float value;
-    FloatValue( float value ) :
-        value( value ) {
+
+    // for rendering from a struct declared with JINJA2CPPLIGHT_REFLECT, see
+    // Reflect.h.  Compiles the template, if it isn't already
+    template< typename T >
+    StructBinding< T > bindStruct() const {
+        return StructBinding< T >( *this, jinja2cpplightFields( (const T *)0 ) );
     }
-    virtual std::string render() {
-        return toString( value );
+
+    const Value *valueAt( int slot ) const {
+        if( slot < (int)values.size() && values[slot].type() != Value::NONE ) {
+            return &values[slot];
+        }
+        return 0;
     }
-    bool isTrue() const {
-        return value != 0.0;
+    const MapKey &slotKey( int slot ) const {
+        return slotKeys[slot];
     }
+
+private:
+    Template( const Template & );
+    Template &operator=( const Template & );
+
+    // only grows while compiling (under compileMutex) or in setValue
+    mutable std::map< std::string, int > slotByName;
+    mutable std::vector< MapKey > slotKeys; // by slot, for looking names up in a Context
+
+    mutable std::mutex compileMutex;
+    mutable std::unique_ptr<Root> root;
+    mutable std::atomic<Root *> compiled; // root, once it is complete
+
+    // length of the most recent render, used to size the next one
+    mutable std::atomic<size_t> lastRenderSize;
 };
-class StringValue : public Value {
+
+template< typename T >
+class ValueHandle {
 public:
-    std::string value;
-    StringValue( std::string value ) :
-        value( value ) {
+    ValueHandle( Template *thetemplate, int slot ) :
+        thetemplate( thetemplate ),
+        slot( slot ) {
     }
-    virtual std::string render() {
-        return value;
+    // no allocation, except for a string that outgrows the previous one
+    void set( const T &value ) {
+        thetemplate->values[slot].set( value );
     }
-    bool isTrue() const {
-        return !value.empty();
+    const Value &get() const {
+        return thetemplate->values[slot];
     }
+private:
+    Template *thetemplate;
+    int slot;
 };
 
-class TupleValue : public Value
-{
+// Jinja2's loop variable, inside a for body: loop.index, loop.index0,
+// loop.revindex, loop.revindex0, loop.first, loop.last and loop.length.
+// Each attribute is worked out from the counter when it's read, so an
+// iteration only has to bump index0.  revindex, last and length need to know
+// how many iterations there are: a filtered loop over a range or a sequence
+// counts its matches first, if the body reads them, but a loop over an
+// Iterable can't know in advance, and reading them there is a render_error.
+// first and last are booleans, rendering as True and False
+class LoopInfo : public Map {
 public:
-    std::vector<std::shared_ptr<Value>> values;
+    int64_t index0; // iterations started so far, less one
+    int64_t length; // -1 if not known
 
-    TupleValue &addValue( int value ) {
-        values.push_back(std::make_shared<IntValue>(value));
-        return *this;
-    }
-    TupleValue &addValue( double value ) {
-        values.push_back(std::make_shared<FloatValue>(value));
-        return *this;
-    }
-    TupleValue &addValue( std::string value ) {
-        values.push_back(std::make_shared<StringValue>(std::move(value)));
-        return *this;
-    }
-    TupleValue &addValue( TupleValue value ) {
-        values.push_back(std::make_shared<TupleValue>(std::move(value)));
-        return *this;
+    LoopInfo() :
+        index0( -1 ),
+        length( -1 ) {
     }
+    size_t size() const;
+    const Value *get( const MapKey &key, Value &scratch ) const;
+    void render( Output &output ) const;
+};
 
-    bool isTrue() const {
-        return !values.empty();
+// one per enclosing for loop, updated in place on each iteration
+class LoopFrame {
+public:
+    const Value *value; // current value of the loop variable
+    Value storage; // for values not stored anywhere else, eg range counters; value points here
+    LoopInfo info; // if this is the frame of a loop variable
+    LoopFrame() :
+        value( 0 ) {
     }
+};
 
-    virtual std::string render() {
-        std::string result = "{";
-        bool isFirst = true;
-
-        for (auto& val : values) {
-            if (isFirst)
-                isFirst = false;
-            else
-                result += ", ";
-
-            result += val ? val->render() : "<empty>";
+// everything that changes while rendering.  One per render call, or one per
+// thread, reused from one render to the next, in which case rendering
+// allocates nothing here
+class RenderContext {
+public:
+    const Template *thetemplate;
+    const Context *globals; // searched for names the template doesn't set; may be 0
+    const void *object; // struct whose members come before the template's values; may be 0
+    const StructFields *objectFields;
+    const std::vector< int > *fieldBySlot; // index into objectFields, or -1
+    // set by {% break %} and {% continue %}: the rest of the loop body is
+    // skipped, and the loop then takes it from there
+    enum LoopControl { NO_JUMP, BREAK, CONTINUE };
+    LoopControl loopControl;
+    std::vector< LoopFrame > frames; // indexed by loop depth
+    // LAZY values computed so far, this render, by address.  Only for values
+    // that stay put for the whole render, the template's and the Context's:
+    // a loop variable or an element may be refilled in place with a
+    // different value, so those are computed each time they're read
+    std::unordered_map< const Value *, Value > lazyResults;
+    // working space for Expression::evaluate, grown to the largest expression
+    std::vector< const Value * > expressionStack;
+    std::vector< Value > expressionValues; // two per stack entry
+
+    RenderContext( const Template &thetemplate, const Context *globals = 0 ) :
+        thetemplate( &thetemplate ),
+        globals( globals ),
+        object( 0 ),
+        objectFields( 0 ),
+        fieldBySlot( 0 ),
+        loopControl( NO_JUMP ) {
+    }
+    // called by Template::render, once the template is compiled
+    void reset( int numFrames ) {
+        if( (int)frames.size() < numFrames ) {
+            frames.resize( numFrames );
         }
-
-        result += "}";
-        return result;
+        lazyResults.clear();
+        loopControl = NO_JUMP;
+    }
+    // the loop variable for a loop that is starting, or 0 if its body
+    // doesn't use it (frame is -1 then).  Set up once per loop, in place
+    LoopInfo *startLoop( int frame, int64_t length ) {
+        if( frame < 0 ) {
+            return 0;
+        }
+        LoopFrame &loopFrame = frames[frame];
+        loopFrame.info.index0 = -1;
+        loopFrame.info.length = length;
+        loopFrame.storage = Value( std::shared_ptr< const Map >( std::shared_ptr< const Map >(), &loopFrame.info ) );
+        loopFrame.value = &loopFrame.storage;
+        return &loopFrame.info;
+    }
+    // at the end of each loop iteration: true if the loop should stop
+    bool endIteration() {
+        const bool stop = loopControl == BREAK;
+        loopControl = NO_JUMP;
+        return stop;
+    }
+    // 0 if undefined.  LAZY values are computed here, the first time they
+    // are read during a render.  The result might be scratch, if it isn't
+    // stored anywhere, eg a view's element
+    const Value *lookup( const VariableRef &ref, Value &scratch ) {
+        const Value *value = ref.frame >= 0 ? frames[ref.frame].value : slotValue( ref.slot, scratch );
+        if( value != 0 && value->type() == Value::LAZY ) {
+            value = ref.frame < 0 && !isField( ref.slot ) ? evaluate( *value ) : compute( *value, scratch );
+        }
+        if( value == 0 || ref.path.empty() ) {
+            return value;
+        }
+        return followPath( value, ref.path, scratch );
     }
-
-    template<typename ... Args>
-    static TupleValue create(Args&& ... args) {
-        TupleValue result;
-
-        createImpl (result, std::forward<Args>(args)...);
-
-        return result;
+    bool isField( int slot ) const {
+        return object != 0 && slot < (int)fieldBySlot->size() && ( *fieldBySlot )[slot] >= 0;
     }
-private:
-    static void createImpl(TupleValue&) {
+    const Value *slotValue( int slot, Value &scratch ) const {
+        if( isField( slot ) ) {
+            return objectFields->fields[( *fieldBySlot )[slot]].get( object, scratch );
+        }
+        const Value *value = thetemplate->valueAt( slot );
+        if( value == 0 && globals != 0 ) {
+            value = globals->get( thetemplate->slotKey( slot ) );
+        }
+        return value;
     }
-
-    template<typename Arg, typename ... Args>
-    static void createImpl(TupleValue& result, Arg&& arg, Args&& ... args) {
-        result.addValue(std::forward<Arg>(arg));
-        createImpl (result, std::forward<Args>(args)...);
+    const Value *followPath( const Value *value, const std::vector< PathStep > &path, Value &scratch );
+    // lazy must stay where it is for the rest of the render; see lazyResults
+    const Value *evaluate( const Value &lazy ) {
+        std::unordered_map< const Value *, Value >::iterator it = lazyResults.find( &lazy );
+        if( it == lazyResults.end() ) {
+            it = lazyResults.insert( std::make_pair( &lazy, lazy.asLazy().compute() ) ).first;
+        }
+        return it->second.type() == Value::NONE ? 0 : &it->second;
     }
+    // without remembering the result; lazy may be scratch itself
+    static const Value *compute( const Value &lazy, Value &scratch );
 };
 
-class Root;
-class ControlSection;
-typedef std::map < std::string, std::shared_ptr<Value> > ValueMap;
-
-class Template {
+// a slice bound, or enumerate's start: a literal, a name, or left out
+class LoopBound {
 public:
-    std::string sourceCode;
-
-    ValueMap valueByName;
+    bool present;
+    int64_t value; // if variable.name is empty, and there's no expression
+    VariableRef variable; // a plain name
+    std::unique_ptr< Expression > expression; // anything else, eg n - 1
+    LoopBound() :
+        present( false ),
+        value( 0 ) {
+    }
+    // SLICE_DEFAULT if not present
+    int64_t evaluate( RenderContext &context ) const;
+};
 
-    // [[[cog
-    // import cog_addheaders
-    // cog_addheaders.add(classname='Template')
-    // ]]]
-    // generated, using cog:
-    Template( std::string sourceCode );
-    STATIC bool isNumber( std::string astring, int *p_value );
-    VIRTUAL ~Template();
-    Template &setValue( std::string name, int value );
-    Template &setValue( std::string name, float value );
-    Template &setValue( std::string name, std::string value );
-    Template&setValue( std::string name, TupleValue value);
-    std::string render();
-    void print(ControlSection *section);
-    int eatSection( int pos, ControlSection *controlSection );
-    STATIC std::string doSubstitutions( std::string sourceCode, const ValueMap &valueByName );
+// what a {% for %} loops over: a name, or a view of other sources, eg
+// reversed(items), items[1:], enumerate(items), zip(range(n), ys).  Views
+// are built when the loop starts, and read the underlying values in place.
+// A loop directly over range() is a ForRangeSection instead
+class LoopSource {
+public:
+    enum Kind { VARIABLE, SLICE, REVERSED, ENUMERATE, ZIP, RANGE };
+    Kind kind;
+    std::string expression; // as written, for error messages
+    VariableRef variable; // for VARIABLE
+    std::vector< std::unique_ptr< LoopSource > > operands;
+    std::vector< LoopBound > bounds; // start, stop, step for SLICE and RANGE; start for ENUMERATE
+
+    LoopSource() :
+        kind( VARIABLE ) {
+    }
+    // either a Value stored somewhere, or storage, filled in
+    const Value *evaluate( RenderContext &context, Value &storage ) const;
+};
 
-    // [[[end]]]
+// see Template::bindStruct.  Holds on to the template, which must outlive it
+template< typename T >
+class StructBinding {
+public:
+    StructBinding( const Template &thetemplate, const StructFields &fields ) :
+        thetemplate( &thetemplate ),
+        fields( &fields ),
+        fieldBySlot( thetemplate.fieldSlots( fields ) ) {
+    }
+    std::string render( const T &object ) const {
+        StringOutput output( thetemplate->estimateSize() );
+        render( object, output );
+        return output.release();
+    }
+    void render( const T &object, Output &output ) const {
+        RenderContext context( *thetemplate );
+        render( object, context, output );
+    }
+    // context may hold a Context for names that aren't members
+    void render( const T &object, RenderContext &context, Output &output ) const {
+        context.object = &object;
+        context.objectFields = fields;
+        context.fieldBySlot = &fieldBySlot;
+        try {
+            thetemplate->render( context, output );
+        } catch( ... ) {
+            context.object = 0;
+            throw;
+        }
+        context.object = 0;
+    }
+private:
+    const Template *thetemplate;
+    const StructFields *fields;
+    std::vector< int > fieldBySlot;
 };
 
 class ControlSection {
@@ -179,7 +401,13 @@ public:
     virtual ~ControlSection() { sections.clear(); }
     
     std::vector< std::unique_ptr<ControlSection> >sections;
-    virtual std::string render( ValueMap &valueByName ) = 0;
+    virtual void render( RenderContext &context, Output &output ) const = 0;
+    // stops early after a {% break %} or {% continue %}
+    void renderSections( RenderContext &context, Output &output ) const {
+        for( size_t i = 0; i < sections.size() && context.loopControl == RenderContext::NO_JUMP; i++ ) {
+            sections[i]->render( context, output );
+        }
+    }
     virtual void print() {
         print("");
     }
@@ -192,7 +420,9 @@ public:
     int sourceCodePosStart;
     int sourceCodePosEnd;
 
-//    std::string render( ValueMap valueByName );
+    virtual void render( RenderContext &context, Output &output ) const {
+        renderSections( context, output );
+    }
     virtual void print( std::string prefix ) {
         std::cout << prefix << "Container ( " << sourceCodePosStart << ", " << sourceCodePosEnd << " ) {" << std::endl;
         for( int i = 0; i < (int)sections.size(); i++ ) {
@@ -202,28 +432,117 @@ public:
     }
 };
 
+// the body of a loop that is only literal text and the loop variable, eg
+// {% for i in range(n) %}a[{{i}}] = image[{{i}}];{% endfor %}.  Rendered
+// without going through the sections: the text is split up once, at compile
+// time, and each batch of iterations is written straight into the output's
+// buffer.  A range counts up in decimal text rather than formatting each
+// index; a sequence of numbers hands the pieces to Sequence::renderEach
+class LoopKernel {
+public:
+    std::vector< std::string > pieces; // the text around each use of the variable
+    size_t piecesLength; // all the pieces together
+
+    // 0 if body holds anything else
+    static std::unique_ptr< LoopKernel > build( const ControlSection &body, int frame );
+    void render( int64_t begin, int64_t end, int64_t step, Output &output ) const;
+    // false if sequence can't do it any faster than the sections would
+    bool render( const Sequence &sequence, Output &output ) const {
+        return sequence.renderEach( &pieces[0], pieces.size(), output );
+    }
+private:
+    void repeatLiteral( size_t count, Output &output ) const;
+};
+
 class ForRangeSection : public ControlSection {
 public:
-    int loopStart;
-    int loopEnd;
+    // range( start, stop, step ); start defaults to 0, step to 1
+    LoopBound start;
+    LoopBound stop;
+    LoopBound step;
     std::string varName;
+    int frame;
+    int loopInfoFrame; // for {{ loop.index }} and so on; -1 if the body doesn't use loop
+    bool countFirst; // filtered, and the body reads loop.length, loop.last or loop.revindex
     int startPos;
     int endPos;
-    std::string render( ValueMap &valueByName ) {
-        std::string result = "";
-//        bool nameExistsBefore = false;
-        if( valueByName.find( varName ) != valueByName.end() ) {
-            throw render_error("variable " + varName + " already exists in this context" );
-        }
-        valueByName[varName] = std::make_shared<IntValue>( 0 );
-        for (auto i = loopStart; i < loopEnd; ++i ){
-            dynamic_cast<IntValue*>(valueByName[varName].get())->value = i;
-            for( size_t j = 0; j < sections.size(); j++ ) {
-                result += sections[j]->render( valueByName );
+    std::unique_ptr< Expression > filter; // {% for i in range(n) if i % 2 %}; may be 0
+    std::unique_ptr< LoopKernel > kernel; // if the body is simple enough
+    // the bounds are read once, as the loop starts; after that the loop is
+    // just a counter, stored straight into the loop variable
+    void render( RenderContext &context, Output &output ) const {
+        const int64_t begin = evaluate( start, 0, context );
+        const int64_t end = evaluate( stop, 0, context );
+        const int64_t increment = evaluate( step, 1, context );
+        if( increment == 0 ) {
+            throw render_error( "range step cannot be zero" );
+        }
+        if( kernel ) {
+            kernel->render( begin, end, increment, output );
+            return;
+        }
+        LoopFrame &loopFrame = context.frames[frame];
+        loopFrame.value = &loopFrame.storage;
+        const int64_t length = !filter ? (int64_t)rangeLength( begin, end, increment ) :
+            countFirst ? countMatches( begin, end, increment, loopFrame, context ) : -1;
+        LoopInfo *info = context.startLoop( loopInfoFrame, length );
+        if( increment > 0 ) {
+            for( int64_t i = begin; i < end; i += increment ) {
+                if( iterate( i, loopFrame, info, context, output ) ) {
+                    break;
+                }
+            }
+        } else {
+            for( int64_t i = begin; i > end; i += increment ) {
+                if( iterate( i, loopFrame, info, context, output ) ) {
+                    break;
+                }
             }
         }
-        valueByName.erase( varName );
-        return result;
+    }
+    int64_t countMatches( int64_t begin, int64_t end, int64_t increment, LoopFrame &loopFrame, RenderContext &context ) const {
+        int64_t count = 0;
+        for( int64_t i = begin; increment > 0 ? i < end : i > end; i += increment ) {
+            loopFrame.storage.setInt( i );
+            count += filter->evaluate( context )->isTrue() ? 1 : 0;
+        }
+        return count;
+    }
+    // true after a {% break %}
+    bool iterate( int64_t i, LoopFrame &loopFrame, LoopInfo *info, RenderContext &context, Output &output ) const {
+        loopFrame.storage.setInt( i );
+        if( filter && !filter->evaluate( context )->isTrue() ) {
+            return false;
+        }
+        if( info != 0 ) {
+            info->index0++;
+        }
+        renderSections( context, output );
+        return context.endIteration();
+    }
+    int64_t evaluate( const LoopBound &bound, int64_t defaultValue, RenderContext &context ) const {
+        if( !bound.present ) {
+            return defaultValue;
+        }
+        if( bound.expression ) {
+            const Value *value = bound.expression->evaluate( context );
+            if( value->type() != Value::INT ) {
+                throw render_error("for loop range var " + bound.expression->source + " must be an int (but it's not)");
+            }
+            return value->asInt();
+        }
+        if( bound.variable.name.empty() ) {
+            return bound.value;
+        }
+        Value scratch;
+        const Value *value = context.lookup( bound.variable, scratch );
+        if( value == 0 ) {
+            throw render_error("for loop range var " + bound.variable.name + " not recognized");
+        }
+        if( value->type() != Value::INT ) {
+            throw render_error("for loop range var " + bound.variable.name + " must be an int (but it's not)");
+        }
+        return value->asInt();
     }
     //Container *contents;
     virtual void print( std::string prefix ) {
@@ -238,28 +557,96 @@ public:
 class ForSection : public ControlSection {
 public:
     std::string varName;
+    int frame; // -1 when unpacking
+    std::vector< int > unpackFrames; // for {% for a, b in pairs %}: one per name
+    int loopInfoFrame; // for {{ loop.index }} and so on; -1 if the body doesn't use loop
+    bool countFirst; // filtered, and the body reads loop.length, loop.last or loop.revindex
     std::string tupVarName;
-    virtual std::string render( ValueMap &valueByName ) {
-        std::string result = "";
-        if( valueByName.find( varName ) != valueByName.end() ) {
-            throw render_error("variable " + varName + " already exists in this context" );
-        }
-        
-        const std::shared_ptr<Value> &val = valueByName.at( tupVarName ); // throws if something happened to the TupleValue
-        const TupleValue *tupValue = dynamic_cast< TupleValue * >( val.get() );
-        if (!tupValue) {
-            throw render_error("variable " + tupVarName + " no longer valid in context" );
-        }
-        const std::vector<std::shared_ptr<Value>> &tupValues = tupValue->values;
-        for ( auto itr = tupValues.cbegin(); itr != tupValues.cend(); ++itr ) {
-            valueByName[ varName ] = *itr;
-            for( std::size_t j = 0; j < sections.size(); ++j) {
-                result += sections[j]->render( valueByName );
+    std::unique_ptr< LoopSource > source;
+    std::unique_ptr< Expression > filter; // {% for x in items if x.enabled %}; may be 0
+    std::unique_ptr< LoopKernel > kernel; // if the body is simple enough
+    // a {% break %} stops pulling elements, so an Iterable is only read as
+    // far as the loop gets
+    virtual void render( RenderContext &context, Output &output ) const {
+        Value sequenceStorage;
+        const Value *val = source->evaluate( context, sequenceStorage );
+        // elements go straight into the loop variable's frame, unless they
+        // are being unpacked
+        Value elementStorage;
+        Value &storage = frame >= 0 ? context.frames[frame].storage : elementStorage;
+        if( val->type() == Value::ITERABLE ) {
+            LoopInfo *info = context.startLoop( loopInfoFrame, -1 );
+            std::unique_ptr< Iterator > iterator = val->asIterable().iterate();
+            while( const Value *element = iterator->next( storage ) ) {
+                if( iterate( element, info, context, output ) ) {
+                    break;
+                }
+            }
+            return;
+        }
+        if( val->type() != Value::SEQUENCE ) {
+            throw render_error("for loop var " + tupVarName + " must be a range or a vector (but it's neither)");
+        }
+        const Sequence &sequence = val->asSequence();
+        if( kernel && kernel->render( sequence, output ) ) {
+            return;
+        }
+        const size_t length = sequence.size();
+        LoopInfo *info = context.startLoop( loopInfoFrame, !filter ? (int64_t)length :
+            countFirst ? countMatches( sequence, storage, context ) : -1 );
+        std::unique_ptr< Iterator > inOrder = sequence.iterate();
+        if( inOrder ) {
+            while( const Value *element = inOrder->next( storage ) ) {
+                if( iterate( element, info, context, output ) ) {
+                    break;
+                }
+            }
+            return;
+        }
+        for( size_t i = 0; i < length; i++ ) {
+            if( iterate( sequence.at( i, storage ), info, context, output ) ) {
+                break;
             }
-            valueByName.erase( varName );
         }
-        
-        return result;
+    }
+    int64_t countMatches( const Sequence &sequence, Value &storage, RenderContext &context ) const {
+        int64_t count = 0;
+        std::unique_ptr< Iterator > inOrder = sequence.iterate();
+        const size_t length = sequence.size();
+        for( size_t i = 0; i < length; i++ ) {
+            bind( context, inOrder ? inOrder->next( storage ) : sequence.at( i, storage ) );
+            count += filter->evaluate( context )->isTrue() ? 1 : 0;
+        }
+        return count;
+    }
+    // true after a {% break %}
+    bool iterate( const Value *element, LoopInfo *info, RenderContext &context, Output &output ) const {
+        bind( context, element );
+        if( filter && !filter->evaluate( context )->isTrue() ) {
+            return false;
+        }
+        if( info != 0 ) {
+            info->index0++;
+        }
+        renderSections( context, output );
+        return context.endIteration();
+    }
+    void bind( RenderContext &context, const Value *element ) const {
+        if( frame >= 0 ) {
+            context.frames[frame].value = element;
+            return;
+        }
+        if( element->type() != Value::SEQUENCE ) {
+            throw render_error( "cannot unpack " + element->render() + " into " + varName );
+        }
+        const Sequence &parts = element->asSequence();
+        if( parts.size() != unpackFrames.size() ) {
+            throw render_error( "cannot unpack " + element->render() + " into " + varName + ": wrong number of values" );
+        }
+        for( size_t i = 0; i < unpackFrames.size(); i++ ) {
+            LoopFrame &loopFrame = context.frames[unpackFrames[i]];
+            loopFrame.value = parts.at( i, loopFrame.storage );
+        }
     }
     virtual void print( std::string prefix ) {
         std::cout << prefix << "For ( " << varName << " in " << tupVarName << " ) {" << std::endl;
@@ -270,14 +657,33 @@ public:
     }
 };
 
+// {% break %} or {% continue %}
+class LoopControlSection : public ControlSection {
+public:
+    RenderContext::LoopControl control;
+    virtual void render( RenderContext &context, Output & ) const {
+        context.loopControl = control;
+    }
+    virtual void print( std::string prefix ) {
+        std::cout << prefix << ( control == RenderContext::BREAK ? "break" : "continue" ) << std::endl;
+    }
+};
+
+// literal text, with {{ ... }} substitutions.  The text is split up once,
+// at compile time: literals[0] name[0] literals[1] name[1] ... literals[n].
+// A plain name is resolved to a VariableRef; anything else is compiled to
+// an Expression
 class Code : public ControlSection {
 public:
 //    vector< ControlSection * >sections;
     int startPos;
     int endPos;
     std::string templateCode;
+    std::vector< std::string > literals;
+    std::vector< VariableRef > vars;
+    std::vector< std::unique_ptr< Expression > > expressions; // one per var; 0 for a plain name
 
-    std::string render();
+    void compile( const Template &thetemplate, const LoopScope &scope );
     virtual void print( std::string prefix ) {
         std::cout << prefix << "Code ( " << startPos << ", " << endPos << " ) {" << std::endl;
         for( int i = 0; i < (int)sections.size(); i++ ) {
@@ -285,24 +691,29 @@ public:
         }
         std::cout << prefix << "}" << std::endl;
     }
-    virtual std::string render( ValueMap &valueByName ) {
-//        std::string templateString = sourceCode.substr( startPos, endPos - startPos );
-//        std::cout << "Code section, rendering [" << templateCode << "]" << std::endl;
-        std::string processed = Template::doSubstitutions( templateCode, valueByName );
-//        std::cout << "Code section, after rendering: [" << processed << "]" << std::endl;
-        return processed;
+    virtual void render( RenderContext &context, Output &output ) const {
+        output.write( literals[0] );
+        Value scratch;
+        for( size_t i = 0; i < vars.size(); i++ ) {
+            const Value *value = expressions[i] ? expressions[i]->evaluate( context ) : context.lookup( vars[i], scratch );
+            if( value == 0 ) {
+                throw render_error( "name " + vars[i].name + " not defined" );
+            }
+            value->render( output );
+            output.write( literals[i + 1] );
+        }
     }
 };
 
 class Root : public ControlSection {
 public:
+    int numFrames; // deepest nesting of for loops
+    Root() :
+        numFrames( 0 ) {
+    }
     virtual ~Root() {}
-    virtual std::string render( ValueMap &valueByName ) {
-        std::string resultString = "";
-        for( int i = 0; i < (int)sections.size(); i++ ) {
-            resultString += sections[i]->render( valueByName );
-        }
-        return resultString;
+    virtual void render( RenderContext &context, Output &output ) const {
+        renderSections( context, output );
     }
     virtual void print(std::string prefix) {
         std::cout << prefix << "Root {" << std::endl;
@@ -313,46 +724,54 @@ public:
     }
 };
 
+// {% if a %}...{% elif b %}...{% else %}...{% endif %}, as one node: the
+// conditions are tried in order, once each, and only the chosen body is
+// rendered.  A chain of tests of one name against different ints, eg
+// {% if mode == 0 %}...{% elif mode == 1 %}..., becomes a table lookup
 class IfSection : public ControlSection {
 public:
-    IfSection(const std::string& expression) {
-        parseIfCondition(expression);
+    // sections[i] is a Container with the body for m_conditions[i], and the
+    // else body comes last, if there is one
+    IfSection(const std::string& expression, const Template &thetemplate, const LoopScope &scope) :
+        m_tableBase(0) {
+        addCondition(expression, thetemplate, scope);
     }
 
-    std::string render(ValueMap &valueByName) {
-        std::stringstream ss;
-        const bool expressionValue = computeExpression(valueByName);
-        if (expressionValue) {
-            for (size_t j = 0; j < sections.size(); j++) {
-                ss << sections[j]->render(valueByName);
-            }
+    //? @param[in] expression E.g. "elif myVariable > 2"
+    void addCondition(const std::string& expression, const Template &thetemplate, const LoopScope &scope);
+    bool hasElse() const {
+        return sections.size() > m_conditions.size();
+    }
+    //? Called once every branch has been added.
+    void buildTable();
+
+    void render(RenderContext &context, Output &output) const {
+        const int branch = chooseBranch(context);
+        if (branch >= 0) {
+            sections[branch]->render(context, output);
         }
-        const std::string renderResult = ss.str();
-        return renderResult;
     }
 
     void print(std::string prefix) {
-        std::cout << prefix << "if ( "
-            << ((m_isNegation) ? "not " : "")
-            << m_variableName << " ) {" << std::endl;
-        if (true) {
-            for (int i = 0; i < (int)sections.size(); i++) {
-                sections[i]->print(prefix + "    ");
+        for (int i = 0; i < (int)sections.size(); i++) {
+            if (i < (int)m_conditions.size()) {
+                std::cout << prefix << (i == 0 ? "if ( " : "elif ( ") << m_conditions[i].source << " ) {" << std::endl;
+            } else {
+                std::cout << prefix << "else {" << std::endl;
             }
+            sections[i]->print(prefix + "    ");
+            std::cout << prefix << "}" << std::endl;
         }
-        std::cout << prefix << "}" << std::endl;
     }
 
 private:
-    //? It determines m_isNegation and m_variableName from @param[in] expression.
-    //? @param[in] expression E.g. "if not myVariable" where myVariable is set by myTemplate.setValue( "myVariable", <any_value> );
-    //?                       The result of this statement is false if myVariable is initialized.
-    void parseIfCondition(const std::string& expression);
-
-    bool computeExpression(const ValueMap &valueByName) const;
+    //? The index into sections of the body to render, or -1 for none.
+    int chooseBranch(RenderContext &context) const;
 
-    bool m_isNegation; ///< Tells whether is there "if not" or just "if" at the begin of expression.
-    std::string m_variableName; ///< This simple "if" implementation allows single variable condition only.
+    std::vector<Expression> m_conditions; ///< One per if and elif, in order.
+    VariableRef m_switchVariable; ///< The name every condition compares, if m_table is used.
+    int64_t m_tableBase; ///< The lowest int any condition compares against.
+    std::vector<int> m_table; ///< Branch for m_tableBase + i, or -1; empty unless the chain can use it.
 };
 
 }
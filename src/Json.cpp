@@ -0,0 +1,362 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Json.h"
+#include "MappedFile.h"
+
+using namespace std;
+
+namespace Jinja2CppLight {
+
+namespace {
+
+const int MAX_DEPTH = 512;
+
+// recursive descent, straight into Values.  The input needn't be
+// null-terminated
+class JsonParser {
+public:
+    JsonParser( const char *data, size_t length, const std::shared_ptr< const void > &owner ) :
+        start( data ),
+        pos( data ),
+        end( data + length ),
+        owner( owner ) {
+    }
+    Value parseDocument() {
+        Value result;
+        parseValue( result, 0 );
+        skipWhitespace();
+        if( pos != end ) {
+            fail( "unexpected text after the json value" );
+        }
+        return result;
+    }
+private:
+    const char *start;
+    const char *pos;
+    const char *end;
+    const std::shared_ptr< const void > &owner;
+
+    void fail( const std::string &message ) const {
+        int line = 1;
+        for( const char *c = start; c < pos && c < end; c++ ) {
+            if( *c == '\n' ) {
+                line++;
+            }
+        }
+        throw json_error( "json: " + message + " at line " + std::to_string( line ) );
+    }
+    void skipWhitespace() {
+        while( pos < end && ( *pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t' ) ) {
+            pos++;
+        }
+    }
+    void expectWord( const char *word, size_t length ) {
+        if( (size_t)( end - pos ) < length || memcmp( pos, word, length ) != 0 ) {
+            fail( "unexpected character" );
+        }
+        pos += length;
+    }
+    void parseValue( Value &result, int depth ) {
+        skipWhitespace();
+        if( pos == end ) {
+            fail( "value expected" );
+        }
+        switch( *pos ) {
+            case '{':
+                if( depth >= MAX_DEPTH ) {
+                    fail( "nested too deeply" );
+                }
+                parseObject( result, depth + 1 );
+                break;
+            case '[':
+                if( depth >= MAX_DEPTH ) {
+                    fail( "nested too deeply" );
+                }
+                parseArray( result, depth + 1 );
+                break;
+            case '"':
+                parseString( result );
+                break;
+            case 't':
+                expectWord( "true", 4 );
+                result.setBool( true );
+                break;
+            case 'f':
+                expectWord( "false", 5 );
+                result.setBool( false );
+                break;
+            case 'n':
+                expectWord( "null", 4 );
+                result = Value();
+                break;
+            default:
+                parseNumber( result );
+        }
+    }
+    void parseObject( Value &result, int depth ) {
+        MapValue object;
+        pos++; // {
+        skipWhitespace();
+        if( pos < end && *pos == '}' ) {
+            pos++;
+            result = Value( std::move( object ) );
+            return;
+        }
+        Value key;
+        Value value;
+        while( true ) {
+            skipWhitespace();
+            if( pos == end || *pos != '"' ) {
+                fail( "key expected" );
+            }
+            parseString( key );
+            skipWhitespace();
+            if( pos == end || *pos != ':' ) {
+                fail( "':' expected" );
+            }
+            pos++;
+            parseValue( value, depth );
+            object.set( std::string( key.stringData(), key.stringLength() ), std::move( value ) );
+            value = Value();
+            skipWhitespace();
+            if( pos < end && *pos == ',' ) {
+                pos++;
+            } else if( pos < end && *pos == '}' ) {
+                pos++;
+                break;
+            } else {
+                fail( "',' or '}' expected" );
+            }
+        }
+        result = Value( std::move( object ) );
+    }
+    void parseArray( Value &result, int depth ) {
+        TupleValue array;
+        pos++; // [
+        skipWhitespace();
+        if( pos < end && *pos == ']' ) {
+            pos++;
+            result = Value( std::move( array ) );
+            return;
+        }
+        while( true ) {
+            array.values.push_back( Value() );
+            parseValue( array.values.back(), depth );
+            skipWhitespace();
+            if( pos < end && *pos == ',' ) {
+                pos++;
+            } else if( pos < end && *pos == ']' ) {
+                pos++;
+                break;
+            } else {
+                fail( "',' or ']' expected" );
+            }
+        }
+        result = Value( std::move( array ) );
+    }
+    // strings without escapes reference the input; short ones are stored
+    // inline, which is cheaper than sharing the owner
+    void parseString( Value &result ) {
+        pos++; // opening quote
+        const char *stringStart = pos;
+        while( pos < end && *pos != '"' && *pos != '\\' ) {
+            if( (unsigned char)*pos < 0x20 ) {
+                fail( "control character in string" );
+            }
+            pos++;
+        }
+        if( pos == end ) {
+            fail( "unterminated string" );
+        }
+        if( *pos == '"' ) {
+            size_t length = pos - stringStart;
+            pos++;
+            if( length <= Value::SMALL_STRING_CAPACITY ) {
+                result.setString( stringStart, length );
+            } else {
+                result = Value::shared( stringStart, length, owner );
+            }
+            return;
+        }
+        std::string decoded( stringStart, pos - stringStart );
+        while( true ) {
+            if( pos == end ) {
+                fail( "unterminated string" );
+            }
+            char c = *pos++;
+            if( c == '"' ) {
+                break;
+            }
+            if( (unsigned char)c < 0x20 ) {
+                fail( "control character in string" );
+            }
+            if( c != '\\' ) {
+                decoded += c;
+                continue;
+            }
+            if( pos == end ) {
+                fail( "unterminated string" );
+            }
+            switch( *pos++ ) {
+                case '"': decoded += '"'; break;
+                case '\\': decoded += '\\'; break;
+                case '/': decoded += '/'; break;
+                case 'b': decoded += '\b'; break;
+                case 'f': decoded += '\f'; break;
+                case 'n': decoded += '\n'; break;
+                case 'r': decoded += '\r'; break;
+                case 't': decoded += '\t'; break;
+                case 'u': appendCodePoint( decoded ); break;
+                default:
+                    fail( "unknown escape in string" );
+            }
+        }
+        result.setString( decoded.data(), decoded.size() );
+    }
+    unsigned int parseHex4() {
+        if( end - pos < 4 ) {
+            fail( "\\u needs four hex digits" );
+        }
+        unsigned int value = 0;
+        for( int i = 0; i < 4; i++ ) {
+            char c = *pos++;
+            value <<= 4;
+            if( c >= '0' && c <= '9' ) {
+                value |= c - '0';
+            } else if( c >= 'a' && c <= 'f' ) {
+                value |= c - 'a' + 10;
+            } else if( c >= 'A' && c <= 'F' ) {
+                value |= c - 'A' + 10;
+            } else {
+                fail( "\\u needs four hex digits" );
+            }
+        }
+        return value;
+    }
+    // after \u; written out as utf-8
+    void appendCodePoint( std::string &decoded ) {
+        unsigned int codePoint = parseHex4();
+        if( codePoint >= 0xd800 && codePoint < 0xdc00 ) {
+            if( end - pos < 2 || pos[0] != '\\' || pos[1] != 'u' ) {
+                fail( "unpaired surrogate in string" );
+            }
+            pos += 2;
+            unsigned int low = parseHex4();
+            if( low < 0xdc00 || low >= 0xe000 ) {
+                fail( "unpaired surrogate in string" );
+            }
+            codePoint = 0x10000 + ( ( codePoint - 0xd800 ) << 10 ) + ( low - 0xdc00 );
+        }
+        if( codePoint < 0x80 ) {
+            decoded += (char)codePoint;
+        } else if( codePoint < 0x800 ) {
+            decoded += (char)( 0xc0 | ( codePoint >> 6 ) );
+            decoded += (char)( 0x80 | ( codePoint & 0x3f ) );
+        } else if( codePoint < 0x10000 ) {
+            decoded += (char)( 0xe0 | ( codePoint >> 12 ) );
+            decoded += (char)( 0x80 | ( ( codePoint >> 6 ) & 0x3f ) );
+            decoded += (char)( 0x80 | ( codePoint & 0x3f ) );
+        } else {
+            decoded += (char)( 0xf0 | ( codePoint >> 18 ) );
+            decoded += (char)( 0x80 | ( ( codePoint >> 12 ) & 0x3f ) );
+            decoded += (char)( 0x80 | ( ( codePoint >> 6 ) & 0x3f ) );
+            decoded += (char)( 0x80 | ( codePoint & 0x3f ) );
+        }
+    }
+    // integers of up to 18 digits are converted here; anything else goes
+    // through strtod, from a null-terminated copy
+    void parseNumber( Value &result ) {
+        const char *numberStart = pos;
+        bool negative = false;
+        if( *pos == '-' ) {
+            negative = true;
+            pos++;
+        }
+        const char *digitsStart = pos;
+        int64_t intValue = 0;
+        while( pos < end && *pos >= '0' && *pos <= '9' ) {
+            // past 18 digits it's a float anyway, and more could overflow
+            if( pos - digitsStart < 18 ) {
+                intValue = intValue * 10 + ( *pos - '0' );
+            }
+            pos++;
+        }
+        size_t numDigits = pos - digitsStart;
+        if( numDigits == 0 ) {
+            fail( "unexpected character" );
+        }
+        if( numDigits > 1 && *digitsStart == '0' ) {
+            fail( "leading zero in number" );
+        }
+        bool isInt = numDigits <= 18;
+        if( pos < end && *pos == '.' ) {
+            isInt = false;
+            pos++;
+            if( pos == end || *pos < '0' || *pos > '9' ) {
+                fail( "digit expected after '.'" );
+            }
+            while( pos < end && *pos >= '0' && *pos <= '9' ) {
+                pos++;
+            }
+        }
+        if( pos < end && ( *pos == 'e' || *pos == 'E' ) ) {
+            isInt = false;
+            pos++;
+            if( pos < end && ( *pos == '+' || *pos == '-' ) ) {
+                pos++;
+            }
+            if( pos == end || *pos < '0' || *pos > '9' ) {
+                fail( "digit expected in exponent" );
+            }
+            while( pos < end && *pos >= '0' && *pos <= '9' ) {
+                pos++;
+            }
+        }
+        if( isInt ) {
+            result.setInt( negative ? -intValue : intValue );
+            return;
+        }
+        std::string number( numberStart, pos - numberStart );
+        result.setFloat( strtod( number.c_str(), 0 ) );
+    }
+};
+
+}
+
+Value parseJson( const char *data, size_t length, std::shared_ptr< const void > owner ) {
+    return JsonParser( data, length, owner ).parseDocument();
+}
+Value parseJson( std::string text ) {
+    std::shared_ptr< const std::string > stored = std::make_shared< const std::string >( std::move( text ) );
+    return parseJson( stored->data(), stored->size(), stored );
+}
+Value loadJson( const std::string &filepath ) {
+    std::shared_ptr< const MappedFile > file = std::make_shared< const MappedFile >( filepath );
+    return parseJson( file->data, file->length, file );
+}
+Context jsonContext( const Value &object ) {
+    const MapValue *map = object.type() == Value::MAP ? dynamic_cast< const MapValue * >( &object.asMap() ) : 0;
+    if( map == 0 ) {
+        throw json_error( "json: a context must be an object" );
+    }
+    Context context;
+    for( size_t i = 0; i < map->entries.size(); i++ ) {
+        context.set( map->entries[i].first, map->entries[i].second );
+    }
+    return context;
+}
+Context loadJsonContext( const std::string &filepath ) {
+    return jsonContext( loadJson( filepath ) );
+}
+
+}
+
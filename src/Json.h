@@ -0,0 +1,45 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// reads JSON into Values, eg template contexts written by another tool:
+//
+//     Context context = loadJsonContext( "kernel.json" );
+//     std::string result = mytemplate.render( context );
+//
+// objects become MapValues, arrays TupleValues, numbers INT or FLOAT, null is
+// NONE, and true and false are 1 and 0.  Strings without escapes point into
+// the input instead of being copied; loadJson maps the file, and the mapping
+// stays alive for as long as any of the Values still use it
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <stdexcept>
+
+#include "Value.h"
+#include "Context.h"
+
+namespace Jinja2CppLight {
+
+class json_error : public std::runtime_error {
+public:
+    json_error( const std::string &what ) :
+        std::runtime_error( what ) {
+    }
+};
+
+// owner keeps data alive; the result may reference data for as long as it
+// lives.  Throws json_error if data isn't valid JSON
+Value parseJson( const char *data, size_t length, std::shared_ptr< const void > owner );
+Value parseJson( std::string text );
+Value loadJson( const std::string &filepath );
+// the names in a JSON object, as one Context layer
+Context jsonContext( const Value &object );
+Context loadJsonContext( const std::string &filepath );
+
+}
+
@@ -0,0 +1,88 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <string>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+
+using namespace std;
+
+namespace Jinja2CppLight {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile( const std::string &filepath ) :
+    data( 0 ),
+    length( 0 ) {
+    FILE *file = fopen( filepath.c_str(), "rb" );
+    if( file == 0 ) {
+        throw runtime_error( "couldnt open " + filepath );
+    }
+    char chunk[1 << 16];
+    size_t read;
+    while( ( read = fread( chunk, 1, sizeof( chunk ), file ) ) > 0 ) {
+        contents.append( chunk, read );
+    }
+    fclose( file );
+    data = contents.data();
+    length = contents.size();
+}
+MappedFile::~MappedFile() {
+}
+void MappedFile::adviseSequential() const {
+}
+
+#else
+
+MappedFile::MappedFile( const std::string &filepath ) :
+    data( 0 ),
+    length( 0 ) {
+    int fd = open( filepath.c_str(), O_RDONLY );
+    if( fd < 0 ) {
+        throw runtime_error( "couldnt open " + filepath + ": " + strerror( errno ) );
+    }
+    struct stat status;
+    if( fstat( fd, &status ) != 0 ) {
+        ::close( fd );
+        throw runtime_error( "couldnt read " + filepath + ": " + strerror( errno ) );
+    }
+    length = (size_t)status.st_size;
+    if( length > 0 ) {
+        void *mapped = mmap( 0, length, PROT_READ, MAP_SHARED, fd, 0 );
+        if( mapped == MAP_FAILED ) {
+            ::close( fd );
+            throw runtime_error( "couldnt map " + filepath + ": " + strerror( errno ) );
+        }
+        data = (const char *)mapped;
+    }
+    ::close( fd );
+}
+MappedFile::~MappedFile() {
+    if( data != 0 ) {
+        munmap( (void *)data, length );
+    }
+}
+void MappedFile::adviseSequential() const {
+    if( data != 0 ) {
+        madvise( (void *)data, length, MADV_SEQUENTIAL );
+    }
+}
+
+#endif
+
+}
+
@@ -0,0 +1,39 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// read-only input files, for the loaders: Values can point straight into the
+// file, holding a shared_ptr to the MappedFile as their owner
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+namespace Jinja2CppLight {
+
+// the whole file, mapped read-only and shared, so processes mapping the same
+// file share the same pages.  Where there is no mmap, it is read in instead
+class MappedFile {
+public:
+    const char *data;
+    size_t length;
+
+    MappedFile( const std::string &filepath );
+    ~MappedFile();
+    // for files read once from start to end: lets the kernel read ahead, and
+    // drop pages already read first
+    void adviseSequential() const;
+private:
+    MappedFile( const MappedFile & );
+    MappedFile &operator=( const MappedFile & );
+
+#ifdef _WIN32
+    std::string contents;
+#endif
+};
+
+}
+
@@ -0,0 +1,175 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <string>
+#include <stdexcept>
+#include <cstdio>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "Output.h"
+
+using namespace std;
+
+namespace Jinja2CppLight {
+
+StringOutput::StringOutput( size_t sizeHint ) {
+    if( sizeHint > 0 ) {
+        grow( sizeHint );
+    }
+}
+std::string StringOutput::release() {
+    buffer.resize( cursor - bufferStart );
+    bufferStart = cursor = bufferEnd = 0;
+    return std::move( buffer );
+}
+void StringOutput::grow( size_t needed ) {
+    size_t used = cursor - bufferStart;
+    size_t newCapacity = buffer.size() * 2;
+    if( newCapacity < used + needed ) {
+        newCapacity = used + needed;
+    }
+    if( newCapacity < 64 ) {
+        newCapacity = 64;
+    }
+    buffer.resize( newCapacity );
+    bufferStart = &buffer[0];
+    cursor = bufferStart + used;
+    bufferEnd = bufferStart + newCapacity;
+}
+
+#ifdef _WIN32
+
+// no mmap here: write through a pre-sized buffer instead, flushing it
+// whenever it fills up
+
+FileOutput::FileOutput( std::string filepath, size_t sizeHint ) :
+    filepath( filepath ),
+    file( 0 ),
+    capacity( 0 ) {
+    file = fopen( filepath.c_str(), "wb" );
+    if( file == 0 ) {
+        throw runtime_error( "couldnt open " + filepath + " for writing" );
+    }
+    capacity = sizeHint < ( 1 << 16 ) ? ( 1 << 16 ) : sizeHint > ( 1 << 24 ) ? ( 1 << 24 ) : sizeHint;
+    bufferStart = cursor = new char[capacity];
+    bufferEnd = bufferStart + capacity;
+}
+FileOutput::~FileOutput() {
+    try {
+        close();
+    } catch( ... ) {
+    }
+}
+void FileOutput::close() {
+    if( file == 0 ) {
+        return;
+    }
+    unmap();
+    FILE *f = (FILE *)file;
+    file = 0;
+    if( fclose( f ) != 0 ) {
+        throw runtime_error( "error writing " + filepath );
+    }
+}
+void FileOutput::grow( size_t needed ) {
+    unmap();
+    if( needed > capacity ) {
+        capacity = needed;
+    }
+    bufferStart = cursor = new char[capacity];
+    bufferEnd = bufferStart + capacity;
+}
+void FileOutput::unmap() {
+    if( bufferStart == 0 ) {
+        return;
+    }
+    size_t used = cursor - bufferStart;
+    size_t written = fwrite( bufferStart, 1, used, (FILE *)file );
+    delete[] bufferStart;
+    bufferStart = cursor = bufferEnd = 0;
+    flushed += used;
+    if( written != used ) {
+        throw runtime_error( "error writing " + filepath );
+    }
+}
+
+#else
+
+FileOutput::FileOutput( std::string filepath, size_t sizeHint ) :
+    filepath( filepath ),
+    fd( -1 ),
+    capacity( 0 ) {
+    fd = open( filepath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666 );
+    if( fd < 0 ) {
+        throw runtime_error( "couldnt open " + filepath + " for writing: " + strerror( errno ) );
+    }
+    if( sizeHint > 0 ) {
+        grow( sizeHint );
+    }
+}
+FileOutput::~FileOutput() {
+    try {
+        close();
+    } catch( ... ) {
+    }
+}
+void FileOutput::close() {
+    if( fd < 0 ) {
+        return;
+    }
+    size_t length = size();
+    unmap();
+    int result = ftruncate( fd, length );
+    ::close( fd );
+    fd = -1;
+    if( result != 0 ) {
+        throw runtime_error( "couldnt truncate " + filepath + ": " + strerror( errno ) );
+    }
+}
+// extends the file and maps it again; pages already written stay in the page
+// cache, so nothing gets copied
+void FileOutput::grow( size_t needed ) {
+    size_t used = size();
+    size_t newCapacity = capacity * 2;
+    if( newCapacity < used + needed ) {
+        newCapacity = used + needed;
+    }
+    size_t pageSize = (size_t)sysconf( _SC_PAGESIZE );
+    newCapacity = ( newCapacity + pageSize - 1 ) / pageSize * pageSize;
+    unmap();
+    if( ftruncate( fd, newCapacity ) != 0 ) {
+        throw runtime_error( "couldnt resize " + filepath + ": " + strerror( errno ) );
+    }
+    void *mapped = mmap( 0, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if( mapped == MAP_FAILED ) {
+        throw runtime_error( "couldnt map " + filepath + ": " + strerror( errno ) );
+    }
+    capacity = newCapacity;
+    flushed = 0; // the mapping always starts at the beginning of the file
+    bufferStart = (char *)mapped;
+    cursor = bufferStart + used;
+    bufferEnd = bufferStart + capacity;
+}
+void FileOutput::unmap() {
+    if( bufferStart == 0 ) {
+        return;
+    }
+    flushed = cursor - bufferStart;
+    munmap( bufferStart, capacity );
+    bufferStart = cursor = bufferEnd = 0;
+}
+
+#endif
+
+}
+
@@ -0,0 +1,114 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// destinations that Template::render writes into
+// - StringOutput: in-memory, what Template::render() returns
+// - FileOutput: writes straight into a memory-mapped file, so the rendered
+//   text goes to the page cache without passing through a std::string
+
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstddef>
+
+namespace Jinja2CppLight {
+
+// append-only buffer; the fast path is an inline memcpy, the derived class
+// only gets involved when the current buffer is full
+class Output {
+public:
+    virtual ~Output() {}
+    void write( const char *data, size_t length ) {
+        if( length == 0 ) {
+            return; // cursor may still be null, and memcpy mustn't see that
+        }
+        if( length > (size_t)( bufferEnd - cursor ) ) {
+            grow( length );
+        }
+        memcpy( cursor, data, length );
+        cursor += length;
+    }
+    void write( const std::string &value ) {
+        write( value.data(), value.size() );
+    }
+    // make sure at least length more bytes fit without growing again
+    void reserve( size_t length ) {
+        if( length > (size_t)( bufferEnd - cursor ) ) {
+            grow( length );
+        }
+    }
+    // for writing straight into the buffer: returns where to write, with room
+    // for at least length bytes, and advance() then moves past what was written
+    char *reserveSpace( size_t length ) {
+        reserve( length );
+        return cursor;
+    }
+    void advance( char *newCursor ) {
+        cursor = newCursor;
+    }
+    // total bytes written so far
+    size_t size() const {
+        return flushed + ( cursor - bufferStart );
+    }
+protected:
+    Output() :
+        bufferStart( 0 ),
+        cursor( 0 ),
+        bufferEnd( 0 ),
+        flushed( 0 ) {
+    }
+    // must leave at least `needed` bytes between cursor and bufferEnd
+    virtual void grow( size_t needed ) = 0;
+
+    char *bufferStart;
+    char *cursor;
+    char *bufferEnd;
+    size_t flushed; // bytes already handed on, and no longer in the buffer
+};
+
+class StringOutput : public Output {
+public:
+    StringOutput( size_t sizeHint = 0 );
+    // returns the rendered text, leaving this output empty
+    std::string release();
+protected:
+    virtual void grow( size_t needed );
+private:
+    StringOutput( const StringOutput & );
+    StringOutput &operator=( const StringOutput & );
+
+    std::string buffer;
+};
+
+// renders into filepath, which is created or truncated.  sizeHint is used to
+// size the mapping up front; the file grows if it turns out to be too small,
+// and is truncated to the length actually written by close()
+class FileOutput : public Output {
+public:
+    std::string filepath;
+
+    FileOutput( std::string filepath, size_t sizeHint = 0 );
+    virtual ~FileOutput();
+    // unmaps, and truncates the file to the rendered length
+    void close();
+protected:
+    virtual void grow( size_t needed );
+private:
+    void unmap();
+    FileOutput( const FileOutput & );
+    FileOutput &operator=( const FileOutput & );
+
+#ifdef _WIN32
+    void *file; // FILE *
+#else
+    int fd;
+#endif
+    size_t capacity;
+};
+
+}
+
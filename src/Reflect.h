@@ -0,0 +1,179 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// renders templates straight from the members of a struct:
+//
+//     struct KernelParams {
+//         int tileX;
+//         int tileY;
+//         std::string dtype;
+//     };
+//     JINJA2CPPLIGHT_REFLECT( KernelParams, tileX, tileY, dtype )
+//
+//     StructBinding< KernelParams > binding = mytemplate.bindStruct< KernelParams >();
+//     std::string result = binding.render( params );
+//
+// bindStruct matches the template's names to members once; after that a
+// render reads each member through a function pointer, with no name lookups,
+// and without copying strings or vectors
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "Value.h"
+
+namespace Jinja2CppLight {
+
+class StructField {
+public:
+    const char *name;
+    // returns the member, as a Value: usually scratch, filled in without
+    // copying strings or arrays, so only valid while the object is
+    const Value *( *get )( const void *object, Value &scratch );
+
+    StructField( const char *name, const Value *( *get )( const void *object, Value &scratch ) ) :
+        name( name ),
+        get( get ) {
+    }
+};
+
+class StructFields {
+public:
+    const StructField *fields;
+    int count;
+
+    StructFields( const StructField *fields, int count ) :
+        fields( fields ),
+        count( count ) {
+    }
+    // -1 if there is no such member
+    int find( const std::string &name ) const {
+        for( int i = 0; i < count; i++ ) {
+            if( name == fields[i].name ) {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+// members of these types can be reflected; anything else is a compile error
+inline const Value *viewField( const Value &member, Value &scratch ) {
+    return viewElement( member, scratch );
+}
+inline const Value *viewField( const std::string &member, Value &scratch ) {
+    return viewElement( member, scratch );
+}
+inline const Value *viewField( const char *member, Value &scratch ) {
+    return viewElement( member, scratch );
+}
+inline const Value *viewField( bool member, Value &scratch ) {
+    scratch.setBool( member );
+    return &scratch;
+}
+inline const Value *viewField( int member, Value &scratch ) {
+    scratch.setInt( member );
+    return &scratch;
+}
+inline const Value *viewField( unsigned int member, Value &scratch ) {
+    scratch.setInt( member );
+    return &scratch;
+}
+inline const Value *viewField( long member, Value &scratch ) {
+    scratch.setInt( member );
+    return &scratch;
+}
+inline const Value *viewField( unsigned long member, Value &scratch ) {
+    scratch.setInt( (int64_t)member );
+    return &scratch;
+}
+inline const Value *viewField( long long member, Value &scratch ) {
+    scratch.setInt( member );
+    return &scratch;
+}
+inline const Value *viewField( unsigned long long member, Value &scratch ) {
+    scratch.setInt( (int64_t)member );
+    return &scratch;
+}
+inline const Value *viewField( double member, Value &scratch ) {
+    scratch.setFloat( member );
+    return &scratch;
+}
+// the containers are viewed in place, through a shared_ptr that owns nothing
+inline const Value *viewField( const TupleValue &member, Value &scratch ) {
+    scratch = Value( std::shared_ptr< const Sequence >( std::shared_ptr< const Sequence >(), &member ) );
+    return &scratch;
+}
+inline const Value *viewField( const MapValue &member, Value &scratch ) {
+    scratch = Value( std::shared_ptr< const Map >( std::shared_ptr< const Map >(), &member ) );
+    return &scratch;
+}
+template< typename T >
+inline const Value *viewField( const std::vector< T > &member, Value &scratch ) {
+    scratch = Value::view( member );
+    return &scratch;
+}
+
+}
+
+// implementation of JINJA2CPPLIGHT_REFLECT: applies m to each argument
+#define JINJA2CPPLIGHT_EXPAND( x ) x
+#define JINJA2CPPLIGHT_FOR_EACH_1( m, x ) m( x )
+#define JINJA2CPPLIGHT_FOR_EACH_2( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_1( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_3( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_2( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_4( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_3( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_5( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_4( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_6( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_5( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_7( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_6( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_8( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_7( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_9( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_8( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_10( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_9( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_11( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_10( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_12( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_11( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_13( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_12( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_14( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_13( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_15( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_14( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_16( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_15( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_17( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_16( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_18( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_17( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_19( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_18( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_20( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_19( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_21( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_20( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_22( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_21( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_23( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_22( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_24( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_23( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_25( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_24( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_26( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_25( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_27( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_26( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_28( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_27( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_29( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_28( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_30( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_29( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_31( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_30( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_32( m, x, ... ) m( x ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_31( m, __VA_ARGS__ ) )
+#define JINJA2CPPLIGHT_FOR_EACH_N( _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, NAME, ... ) NAME
+#define JINJA2CPPLIGHT_FOR_EACH( m, ... ) JINJA2CPPLIGHT_EXPAND( JINJA2CPPLIGHT_FOR_EACH_N( __VA_ARGS__, \
+    JINJA2CPPLIGHT_FOR_EACH_32, JINJA2CPPLIGHT_FOR_EACH_31, JINJA2CPPLIGHT_FOR_EACH_30, JINJA2CPPLIGHT_FOR_EACH_29, JINJA2CPPLIGHT_FOR_EACH_28, JINJA2CPPLIGHT_FOR_EACH_27, JINJA2CPPLIGHT_FOR_EACH_26, JINJA2CPPLIGHT_FOR_EACH_25, JINJA2CPPLIGHT_FOR_EACH_24, JINJA2CPPLIGHT_FOR_EACH_23, JINJA2CPPLIGHT_FOR_EACH_22, JINJA2CPPLIGHT_FOR_EACH_21, JINJA2CPPLIGHT_FOR_EACH_20, JINJA2CPPLIGHT_FOR_EACH_19, JINJA2CPPLIGHT_FOR_EACH_18, JINJA2CPPLIGHT_FOR_EACH_17, JINJA2CPPLIGHT_FOR_EACH_16, JINJA2CPPLIGHT_FOR_EACH_15, JINJA2CPPLIGHT_FOR_EACH_14, JINJA2CPPLIGHT_FOR_EACH_13, JINJA2CPPLIGHT_FOR_EACH_12, JINJA2CPPLIGHT_FOR_EACH_11, JINJA2CPPLIGHT_FOR_EACH_10, JINJA2CPPLIGHT_FOR_EACH_9, JINJA2CPPLIGHT_FOR_EACH_8, JINJA2CPPLIGHT_FOR_EACH_7, JINJA2CPPLIGHT_FOR_EACH_6, JINJA2CPPLIGHT_FOR_EACH_5, JINJA2CPPLIGHT_FOR_EACH_4, JINJA2CPPLIGHT_FOR_EACH_3, JINJA2CPPLIGHT_FOR_EACH_2, JINJA2CPPLIGHT_FOR_EACH_1 )( m, __VA_ARGS__ ) )
+
+#define JINJA2CPPLIGHT_FIELD( member ) \
+    Jinja2CppLight::StructField( #member, []( const void *object, Jinja2CppLight::Value &scratch ) { \
+        return Jinja2CppLight::viewField( static_cast< const ReflectedType * >( object )->member, scratch ); \
+    } ),
+
+// lists the members of Type that templates can use, up to 32 of them.  Put it
+// in the same namespace as Type, so that bindStruct finds it
+#define JINJA2CPPLIGHT_REFLECT( Type, ... ) \
+    inline const Jinja2CppLight::StructFields &jinja2cpplightFields( const Type * ) { \
+        typedef Type ReflectedType; \
+        static const Jinja2CppLight::StructField fields[] = { \
+            JINJA2CPPLIGHT_FOR_EACH( JINJA2CPPLIGHT_FIELD, __VA_ARGS__ ) \
+        }; \
+        static const Jinja2CppLight::StructFields result( fields, (int)( sizeof( fields ) / sizeof( fields[0] ) ) ); \
+        return result; \
+    }
+
@@ -0,0 +1,361 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <vector>
+
+#include "SequenceViews.h"
+
+using namespace std;
+
+namespace Jinja2CppLight {
+
+namespace {
+
+// one position of an enumerate or zip view, refilled in place
+class ViewElement : public Sequence {
+public:
+    std::vector< Value > storage;
+    std::vector< const Value * > elements;
+
+    ViewElement( size_t size ) :
+        storage( size ),
+        elements( size, (const Value *)0 ) {
+    }
+    size_t size() const {
+        return elements.size();
+    }
+    const Value *at( size_t index, Value & ) const {
+        return elements[index];
+    }
+    // a Value that refers to this, without owning it
+    const Value *view( Value &scratch ) const {
+        scratch = Value( std::shared_ptr< const Sequence >( std::shared_ptr< const Sequence >(), this ) );
+        return &scratch;
+    }
+};
+
+// walks a sequence or an iterable the same way
+class Cursor {
+public:
+    Cursor( const Value &value ) :
+        sequence( 0 ),
+        index( 0 ) {
+        if( value.type() == Value::SEQUENCE ) {
+            iterator = value.asSequence().iterate();
+            if( !iterator ) {
+                sequence = &value.asSequence();
+            }
+        } else {
+            iterator = value.asIterable().iterate();
+        }
+    }
+    const Value *next( Value &scratch ) {
+        if( sequence != 0 ) {
+            return index < sequence->size() ? sequence->at( index++, scratch ) : 0;
+        }
+        return iterator->next( scratch );
+    }
+private:
+    const Sequence *sequence;
+    size_t index;
+    std::unique_ptr< Iterator > iterator;
+};
+
+void checkIterable( const Value &value, const char *what ) {
+    if( value.type() != Value::SEQUENCE && value.type() != Value::ITERABLE ) {
+        throw render_error( std::string( what ) + " needs a sequence" );
+    }
+}
+
+class SliceSequence : public Sequence {
+public:
+    Value base;
+    int64_t start;
+    int64_t step;
+    size_t count;
+
+    SliceSequence( const Value &base, int64_t start, int64_t step, size_t count ) :
+        base( base ),
+        start( start ),
+        step( step ),
+        count( count ) {
+    }
+    size_t size() const {
+        return count;
+    }
+    const Value *at( size_t index, Value &scratch ) const {
+        return base.asSequence().at( (size_t)( start + (int64_t)index * step ), scratch );
+    }
+};
+
+class RangeSequence : public Sequence {
+public:
+    int64_t start;
+    int64_t step;
+    size_t count;
+
+    RangeSequence( int64_t start, int64_t step, size_t count ) :
+        start( start ),
+        step( step ),
+        count( count ) {
+    }
+    size_t size() const {
+        return count;
+    }
+    const Value *at( size_t index, Value &scratch ) const {
+        scratch.setInt( start + (int64_t)index * step );
+        return &scratch;
+    }
+};
+
+class SliceIterator : public Iterator {
+public:
+    std::unique_ptr< Iterator > inner;
+    int64_t position; // of the next element inner returns
+    int64_t wanted;
+    int64_t stop; // -1 for no limit
+    int64_t step;
+
+    const Value *next( Value &scratch ) {
+        while( stop < 0 || wanted < stop ) {
+            const Value *element = inner->next( scratch );
+            if( element == 0 ) {
+                return 0;
+            }
+            if( position++ == wanted ) {
+                wanted += step;
+                return element;
+            }
+        }
+        return 0;
+    }
+};
+
+class SliceIterable : public Iterable {
+public:
+    Value base;
+    int64_t start;
+    int64_t stop;
+    int64_t step;
+
+    SliceIterable( const Value &base, int64_t start, int64_t stop, int64_t step ) :
+        base( base ),
+        start( start ),
+        stop( stop ),
+        step( step ) {
+    }
+    std::unique_ptr< Iterator > iterate() const {
+        std::unique_ptr< SliceIterator > iterator( new SliceIterator() );
+        iterator->inner = base.asIterable().iterate();
+        iterator->position = 0;
+        iterator->wanted = start;
+        iterator->stop = stop;
+        iterator->step = step;
+        return std::unique_ptr< Iterator >( iterator.release() );
+    }
+};
+
+class EnumerateSequence : public Sequence {
+public:
+    Value base;
+    int64_t start;
+    mutable ViewElement current;
+
+    EnumerateSequence( const Value &base, int64_t start ) :
+        base( base ),
+        start( start ),
+        current( 2 ) {
+        current.elements[0] = &current.storage[0];
+    }
+    size_t size() const {
+        return base.asSequence().size();
+    }
+    const Value *at( size_t index, Value &scratch ) const {
+        current.storage[0].setInt( start + (int64_t)index );
+        current.elements[1] = base.asSequence().at( index, current.storage[1] );
+        return current.view( scratch );
+    }
+};
+
+class EnumerateIterator : public Iterator {
+public:
+    Cursor cursor;
+    int64_t index;
+    ViewElement current;
+
+    EnumerateIterator( const Value &base, int64_t start ) :
+        cursor( base ),
+        index( start ),
+        current( 2 ) {
+        current.elements[0] = &current.storage[0];
+    }
+    const Value *next( Value &scratch ) {
+        current.elements[1] = cursor.next( current.storage[1] );
+        if( current.elements[1] == 0 ) {
+            return 0;
+        }
+        current.storage[0].setInt( index++ );
+        return current.view( scratch );
+    }
+};
+
+class EnumerateIterable : public Iterable {
+public:
+    Value base;
+    int64_t start;
+
+    EnumerateIterable( const Value &base, int64_t start ) :
+        base( base ),
+        start( start ) {
+    }
+    std::unique_ptr< Iterator > iterate() const {
+        return std::unique_ptr< Iterator >( new EnumerateIterator( base, start ) );
+    }
+};
+
+class ZipSequence : public Sequence {
+public:
+    std::vector< Value > bases;
+    size_t length;
+    mutable ViewElement current;
+
+    ZipSequence( const std::vector< Value > &bases ) :
+        bases( bases ),
+        length( 0 ),
+        current( bases.size() ) {
+        for( size_t i = 0; i < bases.size(); i++ ) {
+            size_t baseLength = bases[i].asSequence().size();
+            if( i == 0 || baseLength < length ) {
+                length = baseLength;
+            }
+        }
+    }
+    size_t size() const {
+        return length;
+    }
+    const Value *at( size_t index, Value &scratch ) const {
+        for( size_t i = 0; i < bases.size(); i++ ) {
+            current.elements[i] = bases[i].asSequence().at( index, current.storage[i] );
+        }
+        return current.view( scratch );
+    }
+};
+
+class ZipIterator : public Iterator {
+public:
+    std::vector< Cursor > cursors;
+    ViewElement current;
+
+    ZipIterator( const std::vector< Value > &bases ) :
+        current( bases.size() ) {
+        for( size_t i = 0; i < bases.size(); i++ ) {
+            cursors.push_back( Cursor( bases[i] ) );
+        }
+    }
+    const Value *next( Value &scratch ) {
+        for( size_t i = 0; i < cursors.size(); i++ ) {
+            current.elements[i] = cursors[i].next( current.storage[i] );
+            if( current.elements[i] == 0 ) {
+                return 0;
+            }
+        }
+        return current.view( scratch );
+    }
+};
+
+class ZipIterable : public Iterable {
+public:
+    std::vector< Value > bases;
+
+    ZipIterable( const std::vector< Value > &bases ) :
+        bases( bases ) {
+    }
+    std::unique_ptr< Iterator > iterate() const {
+        return std::unique_ptr< Iterator >( new ZipIterator( bases ) );
+    }
+};
+
+// where a python slice bound ends up, for a sequence of length items
+int64_t clampBound( int64_t bound, int64_t length, int64_t lowest, int64_t highest ) {
+    if( bound < 0 ) {
+        bound += length;
+    }
+    return bound < lowest ? lowest : bound > highest ? highest : bound;
+}
+
+}
+
+Value sliceView( const Value &base, int64_t start, int64_t stop, int64_t step ) {
+    checkIterable( base, "slice" );
+    if( step == SLICE_DEFAULT ) {
+        step = 1;
+    }
+    if( step == 0 ) {
+        throw render_error( "slice step cannot be zero" );
+    }
+    if( base.type() == Value::ITERABLE ) {
+        if( step < 0 || ( start != SLICE_DEFAULT && start < 0 ) || ( stop != SLICE_DEFAULT && stop < 0 ) ) {
+            throw render_error( "an iterable can only be sliced forwards, from the start" );
+        }
+        return Value( std::shared_ptr< const Iterable >( std::make_shared< SliceIterable >(
+            base, start == SLICE_DEFAULT ? 0 : start, stop == SLICE_DEFAULT ? -1 : stop, step ) ) );
+    }
+    int64_t length = (int64_t)base.asSequence().size();
+    size_t count = 0;
+    if( step > 0 ) {
+        start = start == SLICE_DEFAULT ? 0 : clampBound( start, length, 0, length );
+        stop = stop == SLICE_DEFAULT ? length : clampBound( stop, length, 0, length );
+        count = stop > start ? (size_t)( ( stop - start + step - 1 ) / step ) : 0;
+    } else {
+        start = start == SLICE_DEFAULT ? length - 1 : clampBound( start, length, -1, length - 1 );
+        stop = stop == SLICE_DEFAULT ? -1 : clampBound( stop, length, -1, length - 1 );
+        count = start > stop ? (size_t)( ( start - stop - step - 1 ) / -step ) : 0;
+    }
+    return Value( std::shared_ptr< const Sequence >( std::make_shared< SliceSequence >( base, start, step, count ) ) );
+}
+Value reversedView( const Value &base ) {
+    if( base.type() != Value::SEQUENCE ) {
+        throw render_error( "reversed needs a sequence, not an iterable" );
+    }
+    return sliceView( base, SLICE_DEFAULT, SLICE_DEFAULT, -1 );
+}
+Value rangeView( int64_t start, int64_t stop, int64_t step ) {
+    if( step == 0 ) {
+        throw render_error( "range step cannot be zero" );
+    }
+    return Value( std::shared_ptr< const Sequence >( std::make_shared< RangeSequence >( start, step, rangeLength( start, stop, step ) ) ) );
+}
+// in uint64_t, which holds any difference of two int64_ts, so extreme bounds
+// can't overflow
+size_t rangeLength( int64_t start, int64_t stop, int64_t step ) {
+    if( step > 0 && stop > start ) {
+        return (size_t)( ( (uint64_t)stop - (uint64_t)start - 1 ) / (uint64_t)step + 1 );
+    } else if( step < 0 && start > stop ) {
+        return (size_t)( ( (uint64_t)start - (uint64_t)stop - 1 ) / ( 0 - (uint64_t)step ) + 1 );
+    }
+    return 0;
+}
+Value enumerateView( const Value &base, int64_t start ) {
+    checkIterable( base, "enumerate" );
+    if( base.type() == Value::SEQUENCE ) {
+        return Value( std::shared_ptr< const Sequence >( std::make_shared< EnumerateSequence >( base, start ) ) );
+    }
+    return Value( std::shared_ptr< const Iterable >( std::make_shared< EnumerateIterable >( base, start ) ) );
+}
+Value zipView( const std::vector< Value > &bases ) {
+    bool allSequences = true;
+    for( size_t i = 0; i < bases.size(); i++ ) {
+        checkIterable( bases[i], "zip" );
+        allSequences = allSequences && bases[i].type() == Value::SEQUENCE;
+    }
+    if( allSequences ) {
+        return Value( std::shared_ptr< const Sequence >( std::make_shared< ZipSequence >( bases ) ) );
+    }
+    return Value( std::shared_ptr< const Iterable >( std::make_shared< ZipIterable >( bases ) ) );
+}
+
+}
+
@@ -0,0 +1,42 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// views over sequences and iterables, for loop headers:
+//     {% for x in items[1:] %}, {% for x in reversed(items) %},
+//     {% for p in enumerate(items) %}, {% for p in zip(xs, ys) %},
+//     {% for p in zip(range(0, n, 4), items) %}
+// each reads the underlying values in place; nothing is copied.  enumerate
+// and zip produce one element Sequence per view, refilled for each position,
+// so an element is only valid until the view moves on
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Value.h"
+
+namespace Jinja2CppLight {
+
+// a slice bound that was left out, as in items[1:]
+const int64_t SLICE_DEFAULT = INT64_MIN;
+
+// python slicing: negative bounds count from the end.  Sequences can be
+// sliced any way; iterables only with a positive step and bounds that are
+// not negative.  Throws render_error otherwise, or if step is 0
+Value sliceView( const Value &base, int64_t start, int64_t stop, int64_t step );
+Value reversedView( const Value &base );
+// start, start + step, ... up to but not including stop; step may be negative
+Value rangeView( int64_t start, int64_t stop, int64_t step );
+// how many values rangeView( start, stop, step ) has; step must not be 0
+size_t rangeLength( int64_t start, int64_t stop, int64_t step );
+// elements are ( start + index, element )
+Value enumerateView( const Value &base, int64_t start = 0 );
+// elements are ( bases[0][i], bases[1][i], ... ), as far as the shortest
+Value zipView( const std::vector< Value > &bases );
+
+}
+
@@ -0,0 +1,319 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+
+#include "Value.h"
+#include "numberformat.h"
+
+using namespace std;
+
+namespace Jinja2CppLight {
+
+Value::Value( std::string value ) :
+    valueType( NONE ),
+    inlineString( false ),
+    ownedString( false ),
+    boolean( false ) {
+    if( value.size() <= SMALL_STRING_CAPACITY ) {
+        setString( value.data(), value.size() );
+        return;
+    }
+    // keep the caller's buffer, rather than copying the characters
+    std::shared_ptr< const string > stored = std::make_shared< const string >( std::move( value ) );
+    inlineString = false;
+    ownedString = true;
+    valueType = STRING;
+    payload.text.data = stored->data();
+    payload.text.length = stored->size();
+    owner = stored;
+}
+Value::Value( TupleValue value ) :
+    valueType( NONE ),
+    inlineString( false ),
+    ownedString( false ),
+    boolean( false ) {
+    std::shared_ptr< const TupleValue > stored = std::make_shared< const TupleValue >( std::move( value ) );
+    valueType = SEQUENCE;
+    payload.object = stored.get();
+    owner = stored;
+}
+Value::Value( MapValue value ) :
+    valueType( NONE ),
+    inlineString( false ),
+    ownedString( false ),
+    boolean( false ) {
+    std::shared_ptr< const MapValue > stored = std::make_shared< const MapValue >( std::move( value ) );
+    valueType = MAP;
+    payload.object = stored.get();
+    owner = stored;
+}
+Value::Value( std::shared_ptr< const std::string > value ) :
+    valueType( STRING ),
+    inlineString( false ),
+    ownedString( false ),
+    boolean( false ),
+    owner( value ) {
+    payload.text.data = value->data();
+    payload.text.length = value->size();
+}
+Value::Value( std::shared_ptr< const Sequence > value ) :
+    valueType( SEQUENCE ),
+    inlineString( false ),
+    ownedString( false ),
+    boolean( false ),
+    owner( value ) {
+    payload.object = value.get();
+}
+Value::Value( std::shared_ptr< const Map > value ) :
+    valueType( MAP ),
+    inlineString( false ),
+    ownedString( false ),
+    boolean( false ),
+    owner( value ) {
+    payload.object = value.get();
+}
+Value::Value( LazyValue value ) :
+    valueType( NONE ),
+    inlineString( false ),
+    ownedString( false ),
+    boolean( false ) {
+    std::shared_ptr< const LazyValue > stored = std::make_shared< const LazyValue >( std::move( value ) );
+    valueType = LAZY;
+    payload.object = stored.get();
+    owner = stored;
+}
+Value::Value( std::shared_ptr< const Iterable > value ) :
+    valueType( ITERABLE ),
+    inlineString( false ),
+    ownedString( false ),
+    boolean( false ),
+    owner( value ) {
+    payload.object = value.get();
+}
+Value::Value( GeneratorValue value ) :
+    valueType( NONE ),
+    inlineString( false ),
+    ownedString( false ),
+    boolean( false ) {
+    std::shared_ptr< const GeneratorValue > stored = std::make_shared< const GeneratorValue >( std::move( value ) );
+    valueType = ITERABLE;
+    payload.object = stored.get();
+    owner = stored;
+}
+// a long string that this Value alone holds is overwritten in place, so
+// setting strings of similar length over and over does not allocate
+void Value::setString( const char *data, size_t length ) {
+    if( ownedString && length > SMALL_STRING_CAPACITY && owner.use_count() == 1 ) {
+        string *stored = const_cast< string * >( static_cast< const string * >( owner.get() ) );
+        stored->assign( data, length );
+        payload.text.data = stored->data();
+        payload.text.length = length;
+        return;
+    }
+    release();
+    valueType = STRING;
+    if( length <= SMALL_STRING_CAPACITY ) {
+        inlineString = true;
+        memcpy( payload.small.data, data, length );
+        payload.small.length = (unsigned char)length;
+        return;
+    }
+    std::shared_ptr< const string > stored = std::make_shared< const string >( data, length );
+    inlineString = false;
+    ownedString = true;
+    payload.text.data = stored->data();
+    payload.text.length = length;
+    owner = stored;
+}
+bool Value::isTrue() const {
+    switch( valueType ) {
+        case INT:
+            return payload.intValue != 0;
+        case FLOAT:
+            return payload.floatValue != 0.0;
+        case STRING:
+            return stringLength() != 0;
+        case SEQUENCE:
+            return asSequence().size() != 0;
+        case MAP:
+            return asMap().size() != 0;
+        case LAZY:
+            return asLazy().compute().isTrue();
+        case ITERABLE: {
+            Value scratch;
+            return asIterable().iterate()->next( scratch ) != 0;
+        }
+        default:
+            return false;
+    }
+}
+void Value::render( Output &output ) const {
+    switch( valueType ) {
+        case INT:
+            if( boolean ) {
+                output.write( payload.intValue != 0 ? "True" : "False", payload.intValue != 0 ? 4 : 5 );
+                break;
+            }
+            output.advance( formatInt( payload.intValue, output.reserveSpace( MAX_NUMBER_LENGTH ) ) );
+            break;
+        case FLOAT:
+            output.advance( formatDouble( payload.floatValue, output.reserveSpace( MAX_NUMBER_LENGTH ) ) );
+            break;
+        case STRING:
+            output.write( stringData(), stringLength() );
+            break;
+        case SEQUENCE:
+            asSequence().render( output );
+            break;
+        case MAP:
+            asMap().render( output );
+            break;
+        case LAZY:
+            asLazy().compute().render( output );
+            break;
+        case ITERABLE:
+            asIterable().render( output );
+            break;
+        default:
+            output.write( "None", 4 );
+    }
+}
+std::string Value::render() const {
+    StringOutput output;
+    render( output );
+    return output.release();
+}
+
+std::unique_ptr< Iterator > Sequence::iterate() const {
+    return std::unique_ptr< Iterator >();
+}
+void Sequence::render( Output &output ) const {
+    Value scratch;
+    size_t length = size();
+    output.write( "{", 1 );
+    for( size_t i = 0; i < length; i++ ) {
+        if( i > 0 ) {
+            output.write( ", ", 2 );
+        }
+        at( i, scratch )->render( output );
+    }
+    output.write( "}", 1 );
+}
+
+void Iterable::render( Output &output ) const {
+    Value scratch;
+    std::unique_ptr< Iterator > iterator = iterate();
+    output.write( "{", 1 );
+    for( bool first = true; const Value *element = iterator->next( scratch ); first = false ) {
+        if( !first ) {
+            output.write( ", ", 2 );
+        }
+        element->render( output );
+    }
+    output.write( "}", 1 );
+}
+
+namespace {
+class GeneratorIterator : public Iterator {
+public:
+    GeneratorValue::Generator generator;
+
+    GeneratorIterator( GeneratorValue::Generator generator ) :
+        generator( std::move( generator ) ) {
+    }
+    const Value *next( Value &scratch ) {
+        return generator( scratch ) ? &scratch : 0;
+    }
+};
+}
+std::unique_ptr< Iterator > GeneratorValue::iterate() const {
+    return std::unique_ptr< Iterator >( new GeneratorIterator( start() ) );
+}
+
+MapValue &MapValue::set( std::string key, Value value ) {
+    uint64_t hash = hashKey( key.data(), key.size() );
+    int index = find( key.data(), key.size(), hash );
+    if( index >= 0 ) {
+        entries[index].second = std::move( value );
+        return *this;
+    }
+    entries.push_back( std::make_pair( std::move( key ), std::move( value ) ) );
+    hashes.push_back( hash );
+    if( entries.size() * 2 > buckets.size() ) {
+        rebuildIndex();
+    } else {
+        size_t mask = buckets.size() - 1;
+        size_t bucket = hash & mask;
+        while( buckets[bucket] >= 0 ) {
+            bucket = ( bucket + 1 ) & mask;
+        }
+        buckets[bucket] = (int)entries.size() - 1;
+    }
+    return *this;
+}
+const Value *MapValue::get( const std::string &key ) const {
+    int index = find( key.data(), key.size(), hashKey( key.data(), key.size() ) );
+    return index >= 0 ? &entries[index].second : 0;
+}
+const Value *MapValue::get( const MapKey &key, Value & ) const {
+    size_t hint = key.hint.load( std::memory_order_relaxed );
+    if( hint < entries.size() && hashes[hint] == key.hash && entries[hint].first == key.name ) {
+        return &entries[hint].second;
+    }
+    int index = find( key.name.data(), key.name.size(), key.hash );
+    if( index < 0 ) {
+        return 0;
+    }
+    key.hint.store( index, std::memory_order_relaxed );
+    return &entries[index].second;
+}
+void MapValue::render( Output &output ) const {
+    output.write( "{", 1 );
+    for( size_t i = 0; i < entries.size(); i++ ) {
+        if( i > 0 ) {
+            output.write( ", ", 2 );
+        }
+        output.write( entries[i].first );
+        output.write( ": ", 2 );
+        entries[i].second.render( output );
+    }
+    output.write( "}", 1 );
+}
+int MapValue::find( const char *key, size_t length, uint64_t hash ) const {
+    if( buckets.empty() ) {
+        return -1;
+    }
+    size_t mask = buckets.size() - 1;
+    for( size_t bucket = hash & mask; buckets[bucket] >= 0; bucket = ( bucket + 1 ) & mask ) {
+        int index = buckets[bucket];
+        if( hashes[index] == hash && entries[index].first.size() == length
+                && memcmp( entries[index].first.data(), key, length ) == 0 ) {
+            return index;
+        }
+    }
+    return -1;
+}
+void MapValue::rebuildIndex() {
+    size_t numBuckets = 8;
+    while( numBuckets < entries.size() * 2 ) {
+        numBuckets *= 2;
+    }
+    buckets.assign( numBuckets, -1 );
+    size_t mask = numBuckets - 1;
+    for( size_t i = 0; i < entries.size(); i++ ) {
+        size_t bucket = hashes[i] & mask;
+        while( buckets[bucket] >= 0 ) {
+            bucket = ( bucket + 1 ) & mask;
+        }
+        buckets[bucket] = (int)i;
+    }
+}
+
+}
+
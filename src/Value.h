@@ -0,0 +1,569 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// the values a template is rendered from.  Value is a small tagged type that
+// is passed around by value: ints, floats and short strings are stored
+// inline, and only long strings, tuples and maps live on the heap, kept alive
+// by a shared_ptr
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <cstring>
+#include <functional>
+#include <atomic>
+#include <stdint.h>
+
+#include "Output.h"
+#include "numberformat.h"
+
+namespace Jinja2CppLight {
+
+class render_error : public std::runtime_error {
+public:
+    render_error( const std::string &what ) :
+        std::runtime_error( what ) {
+    }
+};
+
+class Sequence;
+class TupleValue;
+class Map;
+class MapValue;
+class LazyValue;
+class Iterable;
+class Iterator;
+class GeneratorValue;
+
+class Value {
+public:
+    enum Type { NONE, INT, FLOAT, STRING, SEQUENCE, MAP, LAZY, ITERABLE };
+    static const size_t SMALL_STRING_CAPACITY = 23; // stored inline, no allocation
+
+    Value() :
+        valueType( NONE ),
+        inlineString( false ),
+        ownedString( false ),
+        boolean( false ) {
+        payload.intValue = 0;
+    }
+    Value( int value ) :
+        valueType( NONE ),
+        inlineString( false ),
+        ownedString( false ),
+        boolean( false ) {
+        setInt( value );
+    }
+    Value( long value ) :
+        valueType( NONE ),
+        inlineString( false ),
+        ownedString( false ),
+        boolean( false ) {
+        setInt( value );
+    }
+    Value( long long value ) :
+        valueType( NONE ),
+        inlineString( false ),
+        ownedString( false ),
+        boolean( false ) {
+        setInt( value );
+    }
+    Value( double value ) :
+        valueType( NONE ),
+        inlineString( false ),
+        ownedString( false ),
+        boolean( false ) {
+        setFloat( value );
+    }
+    Value( const char *value ) :
+        valueType( NONE ),
+        inlineString( false ),
+        ownedString( false ),
+        boolean( false ) {
+        setString( value, strlen( value ) );
+    }
+    Value( std::string value );
+    Value( TupleValue value );
+    Value( MapValue value );
+    Value( std::shared_ptr< const std::string > value );
+    Value( std::shared_ptr< const Sequence > value );
+    Value( std::shared_ptr< const Map > value );
+    Value( LazyValue value );
+    Value( std::shared_ptr< const Iterable > value );
+    Value( GeneratorValue value );
+
+    // strings that are not copied:
+    // - borrow: the caller's characters, which must stay alive and unchanged
+    //   for as long as the value is in use
+    // - shared: characters inside a buffer that owner keeps alive, eg a
+    //   mapped file; Value( shared_ptr< const string > ) is the common case
+    static Value borrow( const char *data, size_t length ) {
+        return shared( data, length, std::shared_ptr< const void >() );
+    }
+    static Value borrow( const std::string &value ) {
+        return borrow( value.data(), value.size() );
+    }
+    static Value shared( const char *data, size_t length, std::shared_ptr< const void > owner ) {
+        Value result;
+        result.valueType = STRING;
+        result.payload.text.data = data;
+        result.payload.text.length = length;
+        result.owner = std::move( owner );
+        return result;
+    }
+
+    // sequences over the caller's elements, which are not copied, and must
+    // stay alive and unchanged while the value is in use.  Elements can be
+    // ints, floats, doubles, std::strings, const char *s or Values
+    template< typename T >
+    static Value view( const T *data, size_t length );
+    template< typename T >
+    static Value view( const std::vector< T > &values ) {
+        return view( values.empty() ? (const T *)0 : &values[0], values.size() );
+    }
+    template< typename T, size_t N >
+    static Value view( const T (&values)[N] ) {
+        return view( &values[0], N );
+    }
+    // takes over values; no copy of the elements either
+    template< typename T >
+    static Value own( std::vector< T > &&values );
+
+    Type type() const {
+        return valueType;
+    }
+    // an INT from setBool: True or False rather than 1 or 0
+    bool isBool() const {
+        return valueType == INT && boolean;
+    }
+    int64_t asInt() const {
+        return payload.intValue;
+    }
+    double asFloat() const {
+        return payload.floatValue;
+    }
+    const char *stringData() const {
+        return inlineString ? payload.small.data : payload.text.data;
+    }
+    size_t stringLength() const {
+        return inlineString ? payload.small.length : payload.text.length;
+    }
+    std::string asString() const {
+        return std::string( stringData(), stringLength() );
+    }
+    const Sequence &asSequence() const {
+        return *static_cast< const Sequence * >( payload.object );
+    }
+    const Map &asMap() const {
+        return *static_cast< const Map * >( payload.object );
+    }
+    const LazyValue &asLazy() const {
+        return *static_cast< const LazyValue * >( payload.object );
+    }
+    const Iterable &asIterable() const {
+        return *static_cast< const Iterable * >( payload.object );
+    }
+
+    // in place, no allocation unless a long string is being stored
+    void setInt( int64_t value ) {
+        release();
+        valueType = INT;
+        payload.intValue = value;
+    }
+    // an INT 1 or 0 that renders as True or False
+    void setBool( bool value ) {
+        setInt( value ? 1 : 0 );
+        boolean = true;
+    }
+    void setFloat( double value ) {
+        release();
+        valueType = FLOAT;
+        payload.floatValue = value;
+    }
+    void setString( const char *data, size_t length );
+
+    void set( int value ) {
+        setInt( value );
+    }
+    void set( long value ) {
+        setInt( value );
+    }
+    void set( long long value ) {
+        setInt( value );
+    }
+    void set( double value ) {
+        setFloat( value );
+    }
+    void set( const char *value ) {
+        setString( value, strlen( value ) );
+    }
+    void set( const std::string &value ) {
+        setString( value.data(), value.size() );
+    }
+    void set( const Value &value ) {
+        *this = value;
+    }
+
+    bool isTrue() const;
+    void render( Output &output ) const;
+    std::string render() const;
+
+private:
+    void release() {
+        if( owner ) {
+            owner.reset();
+        }
+        inlineString = false;
+        ownedString = false;
+        boolean = false;
+    }
+
+    struct SmallString {
+        char data[SMALL_STRING_CAPACITY];
+        unsigned char length;
+    };
+    struct Text {
+        const char *data;
+        size_t length;
+    };
+    union Payload {
+        int64_t intValue;
+        double floatValue;
+        SmallString small;
+        Text text;
+        const void *object; // Sequence, Map, LazyValue or Iterable
+    };
+
+    Payload payload;
+    Type valueType;
+    bool inlineString;
+    bool ownedString; // owner is a std::string created by this class
+    bool boolean; // from setBool
+    std::shared_ptr< const void > owner; // whatever payload points into, if anything
+};
+
+// anything that {% for %} can iterate over
+class Sequence {
+public:
+    virtual ~Sequence() {}
+    virtual size_t size() const = 0;
+    // element index: either a pointer to a Value stored in the sequence, or
+    // scratch, filled in with the element
+    virtual const Value *at( size_t index, Value &scratch ) const = 0;
+    // {a, b, c}
+    virtual void render( Output &output ) const;
+    // walks the elements in order, for a sequence that can do that more
+    // cheaply than at(), eg by reusing one element object; 0 if it can't.
+    // As for an Iterable, each element is only valid until the next
+    virtual std::unique_ptr< Iterator > iterate() const;
+    // renders a for loop body that is only text and the loop variable, as
+    // for formatEach in numberformat.h, if this can do that faster than one
+    // element at a time; false if it can't, and nothing was written
+    virtual bool renderEach( const std::string *, size_t, Output & ) const {
+        return false;
+    }
+};
+
+class TupleValue : public Sequence
+{
+public:
+    std::vector< Value > values;
+
+    size_t size() const {
+        return values.size();
+    }
+    const Value *at( size_t index, Value & ) const {
+        return &values[index];
+    }
+
+    TupleValue &addValue( int value ) {
+        values.push_back( Value( value ) );
+        return *this;
+    }
+    TupleValue &addValue( double value ) {
+        values.push_back( Value( value ) );
+        return *this;
+    }
+    TupleValue &addValue( const char *value ) {
+        values.push_back( Value( value ) );
+        return *this;
+    }
+    TupleValue &addValue( std::string value ) {
+        values.push_back( Value( std::move( value ) ) );
+        return *this;
+    }
+    TupleValue &addValue( TupleValue value ) {
+        values.push_back( Value( std::move( value ) ) );
+        return *this;
+    }
+    TupleValue &addValue( Value value ) {
+        values.push_back( std::move( value ) );
+        return *this;
+    }
+
+    template<typename ... Args>
+    static TupleValue create(Args&& ... args) {
+        TupleValue result;
+
+        createImpl (result, std::forward<Args>(args)...);
+
+        return result;
+    }
+private:
+    static void createImpl(TupleValue&) {
+    }
+
+    template<typename Arg, typename ... Args>
+    static void createImpl(TupleValue& result, Arg&& arg, Args&& ... args) {
+        result.addValue(std::forward<Arg>(arg));
+        createImpl (result, std::forward<Args>(args)...);
+    }
+};
+
+inline const Value *viewElement( const Value &element, Value & ) {
+    return &element;
+}
+inline const Value *viewElement( const std::string &element, Value &scratch ) {
+    scratch = Value::borrow( element );
+    return &scratch;
+}
+inline const Value *viewElement( const char *element, Value &scratch ) {
+    scratch = Value::borrow( element, strlen( element ) );
+    return &scratch;
+}
+template< typename T >
+inline const Value *viewElement( const T &element, Value &scratch ) {
+    scratch.set( element );
+    return &scratch;
+}
+
+// see Value::view
+template< typename T >
+class SequenceView : public Sequence {
+public:
+    const T *data;
+    size_t length;
+
+    SequenceView( const T *data, size_t length ) :
+        data( data ),
+        length( length ) {
+    }
+    size_t size() const {
+        return length;
+    }
+    const Value *at( size_t index, Value &scratch ) const {
+        return viewElement( data[index], scratch );
+    }
+    // numbers are formatted in batches, rather than one Value at a time
+    void render( Output &output ) const {
+        renderElements( data, length, output );
+    }
+    bool renderEach( const std::string *pieces, size_t numPieces, Output &output ) const {
+        return renderEach( data, pieces, numPieces, output );
+    }
+private:
+    template< typename E >
+    bool renderEach( const E *, const std::string *, size_t, Output & ) const {
+        return false;
+    }
+    bool renderEach( const int *values, const std::string *pieces, size_t numPieces, Output &output ) const {
+        formatEach( values, length, pieces, numPieces, output );
+        return true;
+    }
+    bool renderEach( const long *values, const std::string *pieces, size_t numPieces, Output &output ) const {
+        formatEach( values, length, pieces, numPieces, output );
+        return true;
+    }
+    bool renderEach( const long long *values, const std::string *pieces, size_t numPieces, Output &output ) const {
+        formatEach( values, length, pieces, numPieces, output );
+        return true;
+    }
+    bool renderEach( const float *values, const std::string *pieces, size_t numPieces, Output &output ) const {
+        formatEach( values, length, pieces, numPieces, output );
+        return true;
+    }
+    bool renderEach( const double *values, const std::string *pieces, size_t numPieces, Output &output ) const {
+        formatEach( values, length, pieces, numPieces, output );
+        return true;
+    }
+    template< typename E >
+    void renderElements( const E *, size_t, Output &output ) const {
+        Sequence::render( output );
+    }
+    void renderElements( const int *values, size_t count, Output &output ) const {
+        formatNumbers( values, count, output );
+    }
+    void renderElements( const long *values, size_t count, Output &output ) const {
+        formatNumbers( values, count, output );
+    }
+    void renderElements( const long long *values, size_t count, Output &output ) const {
+        formatNumbers( values, count, output );
+    }
+    void renderElements( const float *values, size_t count, Output &output ) const {
+        formatNumbers( values, count, output );
+    }
+    void renderElements( const double *values, size_t count, Output &output ) const {
+        formatNumbers( values, count, output );
+    }
+};
+
+// see Value::own.  Numbers are stored densely, eg a std::vector< float >
+// of weights, rather than one Value each
+template< typename T >
+class OwnedSequence : public SequenceView< T > {
+public:
+    std::vector< T > values;
+
+    OwnedSequence( std::vector< T > &&values ) :
+        SequenceView< T >( 0, 0 ),
+        values( std::move( values ) ) {
+        this->data = this->values.empty() ? 0 : &this->values[0];
+        this->length = this->values.size();
+    }
+};
+
+template< typename T >
+Value Value::view( const T *data, size_t length ) {
+    return Value( std::shared_ptr< const Sequence >( std::make_shared< SequenceView< T > >( data, length ) ) );
+}
+template< typename T >
+Value Value::own( std::vector< T > &&values ) {
+    return Value( std::shared_ptr< const Sequence >( std::make_shared< OwnedSequence< T > >( std::move( values ) ) ) );
+}
+
+// walks an Iterable once, from the start
+class Iterator {
+public:
+    virtual ~Iterator() {}
+    // the next element, or 0 once there are no more.  Either a Value stored
+    // somewhere else, or scratch, filled in with the element; only valid
+    // until the next call
+    virtual const Value *next( Value &scratch ) = 0;
+};
+
+// for elements that are produced one at a time, and never all held at once:
+// generators, streamed files, row readers.  {% for %} pulls elements one by
+// one, so rendering needs the same memory however many there are.  Every
+// loop over it calls iterate() again, starting from the beginning
+class Iterable {
+public:
+    virtual ~Iterable() {}
+    virtual std::unique_ptr< Iterator > iterate() const = 0;
+    // {a, b, c}
+    virtual void render( Output &output ) const;
+};
+
+// an Iterable from a callback:
+//     mytemplate.setValue( "squares", GeneratorValue( []() {
+//         int i = 0;
+//         return GeneratorValue::Generator( [i]( Value &next ) mutable {
+//             next.setInt( i * i );
+//             return ++i <= 10;
+//         } );
+//     } ) );
+// start is called at the start of each loop, for a fresh generator, and the
+// generator then fills in one element per call, returning false once there
+// are no more
+class GeneratorValue : public Iterable {
+public:
+    typedef std::function< bool( Value &next ) > Generator;
+    std::function< Generator() > start;
+
+    GeneratorValue( std::function< Generator() > start ) :
+        start( std::move( start ) ) {
+    }
+    std::unique_ptr< Iterator > iterate() const;
+};
+
+// a value that is only computed if a template actually reads it, at most
+// once per render.  compute may be called from several threads at once, if
+// the template is being rendered from several threads
+//     mytemplate.setValue( "kernel", LazyValue( [&]() { return Value( buildKernel() ); } ) );
+class LazyValue
+{
+public:
+    std::function< Value() > compute;
+
+    LazyValue( std::function< Value() > compute ) :
+        compute( std::move( compute ) ) {
+    }
+};
+
+// FNV-1a
+inline uint64_t hashKey( const char *data, size_t length ) {
+    uint64_t hash = 14695981039346656037ULL;
+    for( size_t i = 0; i < length; i++ ) {
+        hash = ( hash ^ (unsigned char)data[i] ) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// a key that is looked up over and over, eg the x in {{ cfg.tile.x }}: it is
+// hashed once, when the template is compiled, and hint remembers where the
+// key was found last time, so a Map can check there first
+class MapKey {
+public:
+    std::string name;
+    uint64_t hash;
+    mutable std::atomic< size_t > hint;
+
+    MapKey( const std::string &name ) :
+        name( name ),
+        hash( hashKey( name.data(), name.size() ) ),
+        hint( 0 ) {
+    }
+    MapKey( const MapKey &other ) :
+        name( other.name ),
+        hash( other.hash ),
+        hint( other.hint.load( std::memory_order_relaxed ) ) {
+    }
+    MapKey &operator=( const MapKey &other ) {
+        name = other.name;
+        hash = other.hash;
+        hint.store( other.hint.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+        return *this;
+    }
+};
+
+// anything with string keys, that {{ value.key }} can look into
+class Map {
+public:
+    virtual ~Map() {}
+    virtual size_t size() const = 0;
+    // 0 if key is missing.  Otherwise either a Value stored in the map, or
+    // scratch, filled in with the value
+    virtual const Value *get( const MapKey &key, Value &scratch ) const = 0;
+    virtual void render( Output &output ) const = 0;
+};
+
+// string keys, kept in insertion order, with an open addressing index on top
+class MapValue : public Map
+{
+public:
+    std::vector< std::pair< std::string, Value > > entries; // read only: add entries with set()
+
+    MapValue &set( std::string key, Value value );
+    const Value *get( const std::string &key ) const;
+
+    size_t size() const {
+        return entries.size();
+    }
+    const Value *get( const MapKey &key, Value &scratch ) const;
+    void render( Output &output ) const;
+private:
+    int find( const char *key, size_t length, uint64_t hash ) const;
+    void rebuildIndex();
+
+    std::vector< uint64_t > hashes; // one per entry
+    std::vector< int > buckets; // entry index, or -1; size is a power of two
+};
+
+}
+
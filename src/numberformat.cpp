@@ -0,0 +1,179 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <cstdio>
+#include <cmath>
+
+#include "numberformat.h"
+#include "Output.h"
+
+namespace Jinja2CppLight {
+
+namespace {
+    const char DIGIT_PAIRS[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+    int countDigits( uint64_t value ) {
+        int digits = 1;
+        while( value >= 10000 ) {
+            value /= 10000;
+            digits += 4;
+        }
+        if( value >= 1000 ) {
+            return digits + 3;
+        }
+        if( value >= 100 ) {
+            return digits + 2;
+        }
+        if( value >= 10 ) {
+            return digits + 1;
+        }
+        return digits;
+    }
+
+    char *formatNumber( int value, char *out ) {
+        return formatInt( value, out );
+    }
+    char *formatNumber( long value, char *out ) {
+        return formatInt( value, out );
+    }
+    char *formatNumber( long long value, char *out ) {
+        return formatInt( value, out );
+    }
+    char *formatNumber( float value, char *out ) {
+        return formatDouble( value, out );
+    }
+    char *formatNumber( double value, char *out ) {
+        return formatDouble( value, out );
+    }
+
+    // numbers per batch, so each batch needs just one bounds check on the output
+    const size_t BATCH_SIZE = 256;
+
+    template< typename T >
+    void formatNumbersImpl( const T *values, size_t count, Output &output ) {
+        output.write( "{", 1 );
+        for( size_t batchStart = 0; batchStart < count; batchStart += BATCH_SIZE ) {
+            size_t batchEnd = batchStart + BATCH_SIZE < count ? batchStart + BATCH_SIZE : count;
+            char *out = output.reserveSpace( ( batchEnd - batchStart ) * ( MAX_NUMBER_LENGTH + 2 ) );
+            for( size_t i = batchStart; i < batchEnd; i++ ) {
+                if( i > 0 ) {
+                    *out++ = ',';
+                    *out++ = ' ';
+                }
+                out = formatNumber( values[i], out );
+            }
+            output.advance( out );
+        }
+        output.write( "}", 1 );
+    }
+
+    template< typename T >
+    void formatEachImpl( const T *values, size_t count, const std::string *pieces, size_t numPieces, Output &output ) {
+        size_t piecesLength = 0;
+        for( size_t i = 0; i < numPieces; i++ ) {
+            piecesLength += pieces[i].size();
+        }
+        // batches of about 64KB, as for range loops
+        const size_t iterationLength = piecesLength + ( numPieces - 1 ) * MAX_NUMBER_LENGTH;
+        if( iterationLength == 0 ) {
+            return;
+        }
+        const size_t batchSize = iterationLength < 65536 ? 65536 / iterationLength : 1;
+        char formatted[MAX_NUMBER_LENGTH];
+        for( size_t done = 0; done < count; ) {
+            const size_t batchEnd = count - done < batchSize ? count : done + batchSize;
+            char *out = output.reserveSpace( ( batchEnd - done ) * iterationLength );
+            for( ; done < batchEnd; done++ ) {
+                const size_t length = formatNumber( values[done], formatted ) - formatted;
+                memcpy( out, pieces[0].data(), pieces[0].size() );
+                out += pieces[0].size();
+                for( size_t i = 1; i < numPieces; i++ ) {
+                    memcpy( out, formatted, length );
+                    out += length;
+                    memcpy( out, pieces[i].data(), pieces[i].size() );
+                    out += pieces[i].size();
+                }
+            }
+            output.advance( out );
+        }
+    }
+}
+
+char *formatInt( int64_t value, char *out ) {
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    if( value < 0 ) {
+        *out++ = '-';
+    }
+    char *end = out + countDigits( magnitude );
+    char *p = end;
+    while( magnitude >= 100 ) {
+        unsigned pair = (unsigned)( magnitude % 100 ) * 2;
+        magnitude /= 100;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+    if( magnitude >= 10 ) {
+        unsigned pair = (unsigned)magnitude * 2;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    } else {
+        *--p = (char)( '0' + magnitude );
+    }
+    return end;
+}
+char *formatDouble( double value, char *out ) {
+    // whole numbers below 1e6 come out of %g without a decimal point or
+    // exponent, so they can take the integer path
+    if( value > -1e6 && value < 1e6 && value == (double)(int64_t)value && !( value == 0 && std::signbit( value ) ) ) {
+        return formatInt( (int64_t)value, out );
+    }
+    return out + snprintf( out, MAX_NUMBER_LENGTH, "%g", value );
+}
+
+void formatNumbers( const int *values, size_t count, Output &output ) {
+    formatNumbersImpl( values, count, output );
+}
+void formatNumbers( const long *values, size_t count, Output &output ) {
+    formatNumbersImpl( values, count, output );
+}
+void formatNumbers( const long long *values, size_t count, Output &output ) {
+    formatNumbersImpl( values, count, output );
+}
+void formatNumbers( const float *values, size_t count, Output &output ) {
+    formatNumbersImpl( values, count, output );
+}
+void formatNumbers( const double *values, size_t count, Output &output ) {
+    formatNumbersImpl( values, count, output );
+}
+
+void formatEach( const int *values, size_t count, const std::string *pieces, size_t numPieces, Output &output ) {
+    formatEachImpl( values, count, pieces, numPieces, output );
+}
+void formatEach( const long *values, size_t count, const std::string *pieces, size_t numPieces, Output &output ) {
+    formatEachImpl( values, count, pieces, numPieces, output );
+}
+void formatEach( const long long *values, size_t count, const std::string *pieces, size_t numPieces, Output &output ) {
+    formatEachImpl( values, count, pieces, numPieces, output );
+}
+void formatEach( const float *values, size_t count, const std::string *pieces, size_t numPieces, Output &output ) {
+    formatEachImpl( values, count, pieces, numPieces, output );
+}
+void formatEach( const double *values, size_t count, const std::string *pieces, size_t numPieces, Output &output ) {
+    formatEachImpl( values, count, pieces, numPieces, output );
+}
+
+}
+
@@ -0,0 +1,77 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// number to text, without going through a std::ostream.  Output is the same
+// as toString() gives, ie what a default std::ostream writes
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+namespace Jinja2CppLight {
+
+class Output;
+
+const size_t MAX_NUMBER_LENGTH = 32; // longest text any of these write
+
+// each writes the number starting at out, and returns the end of the text
+char *formatInt( int64_t value, char *out );
+char *formatDouble( double value, char *out );
+
+// the text of a counter that only goes up by one at a time, kept up to date
+// in place: most steps change just the last digit, so this is cheaper than
+// formatting each value afresh.  Only for values that are not negative
+class DecimalCounter {
+public:
+    DecimalCounter( int64_t value ) {
+        char *end = formatInt( value, digits );
+        first = MAX_NUMBER_LENGTH - ( end - digits );
+        memmove( digits + first, digits, end - digits );
+    }
+    void increment() {
+        size_t pos = MAX_NUMBER_LENGTH - 1;
+        while( digits[pos] == '9' ) {
+            digits[pos] = '0';
+            if( pos == first ) {
+                digits[--first] = '1';
+                return;
+            }
+            pos--;
+        }
+        digits[pos]++;
+    }
+    const char *data() const {
+        return digits + first;
+    }
+    size_t size() const {
+        return MAX_NUMBER_LENGTH - first;
+    }
+private:
+    char digits[MAX_NUMBER_LENGTH]; // right aligned
+    size_t first;
+};
+
+// {a, b, c}, formatted in batches straight into output's buffer
+void formatNumbers( const int *values, size_t count, Output &output );
+void formatNumbers( const long *values, size_t count, Output &output );
+void formatNumbers( const long long *values, size_t count, Output &output );
+void formatNumbers( const float *values, size_t count, Output &output );
+void formatNumbers( const double *values, size_t count, Output &output );
+
+// a for loop body over values, eg a[{{x}}] = {{x}};, without going through
+// a Value per element: for each value, pieces[0], the value, pieces[1], the
+// value, and so on up to pieces[numPieces - 1].  Also in batches
+void formatEach( const int *values, size_t count, const std::string *pieces, size_t numPieces, Output &output );
+void formatEach( const long *values, size_t count, const std::string *pieces, size_t numPieces, Output &output );
+void formatEach( const long long *values, size_t count, const std::string *pieces, size_t numPieces, Output &output );
+void formatEach( const float *values, size_t count, const std::string *pieces, size_t numPieces, Output &output );
+void formatEach( const double *values, size_t count, const std::string *pieces, size_t numPieces, Output &output );
+
+}
+
@@ -0,0 +1,105 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+
+#include "gtest/gtest.h"
+#include "test/gtest_supp.h"
+
+#include "Columnar.h"
+#include "Jinja2CppLight.h"
+
+using namespace std;
+using namespace Jinja2CppLight;
+
+namespace {
+void writeRecords( const std::string &filepath ) {
+    std::vector< int64_t > ids;
+    ids.push_back( 1 );
+    ids.push_back( 2 );
+    ids.push_back( -3 );
+    std::vector< double > prices;
+    prices.push_back( 1.5 );
+    prices.push_back( 20 );
+    prices.push_back( 0.25 );
+    std::vector< std::string > names;
+    names.push_back( "apple" );
+    names.push_back( "" );
+    names.push_back( std::string( 40, 'c' ) );
+    ColumnarWriter().addColumn( "id", ids ).addColumn( "price", prices ).addColumn( "name", names ).write( filepath );
+}
+}
+
+TEST( testColumnar, readBack ) {
+    const std::string filepath = "jinja2cpplight_test_readBack.cols";
+    writeRecords( filepath );
+    ColumnarTable table( filepath );
+    remove( filepath.c_str() ); // the mapping stays valid
+    EXPECT_EQ( 3u, table.numRows() );
+    EXPECT_EQ( 3, table.numColumns() );
+    EXPECT_EQ( "price", table.columnName( 1 ) );
+    EXPECT_EQ( ColumnarTable::STRING, table.columnType( 2 ) );
+    EXPECT_EQ( 2, table.findColumn( "name" ) );
+    EXPECT_EQ( -1, table.findColumn( "missing" ) );
+    EXPECT_EQ( "{1, 2, -3}", table.column( "id" ).render() );
+    EXPECT_EQ( "{1.5, 20, 0.25}", table.column( "price" ).render() );
+    EXPECT_EQ( "{apple, , " + std::string( 40, 'c' ) + "}", table.column( "name" ).render() );
+
+    Value scratch;
+    EXPECT_EQ( "{id: 1, price: 1.5, name: apple}", table.rows().asSequence().at( 0, scratch )->render() );
+}
+
+TEST( testColumnar, renderRows ) {
+    const std::string filepath = "jinja2cpplight_test_renderRows.cols";
+    writeRecords( filepath );
+    Template mytemplate( "{% for r in records %}{{r.id}}:{{r.name}}={{r.price}};{% endfor %}{{ prices[1] }}" );
+    Value records;
+    {
+        ColumnarTable table( filepath );
+        records = table.rows();
+        mytemplate.setValue( "records", records );
+        mytemplate.setValue( "prices", table.column( "price" ) );
+    }
+    remove( filepath.c_str() );
+    // the values keep the file mapped, after the table has gone
+    EXPECT_EQ( "1:apple=1.5;2:=20;-3:" + std::string( 40, 'c' ) + "=0.25;20", mytemplate.render() );
+
+    // each loop moves its own row along, so loops over the same rows can nest
+    Template nested( "{% for a in records %}{% for b in records %}{{ a.id * b.id }},{% endfor %}{{ a.price }};{% endfor %}|"
+        "{% for i, r in enumerate(records) %}{{ i }}{{ r.id }}{% endfor %}|{{ records[2].id }}" );
+    nested.setValue( "records", records );
+    EXPECT_EQ( "1,2,-3,1.5;2,4,-6,20;-3,-6,9,0.25;|01122-3|-3", nested.render() );
+}
+
+TEST( testColumnar, badFiles ) {
+    const std::string filepath = "jinja2cpplight_test_badFiles.cols";
+    {
+        std::ofstream out( filepath.c_str() );
+        out << "not a columnar file, but long enough to have a header";
+    }
+    bool threw = false;
+    try {
+        ColumnarTable table( filepath );
+    } catch( std::runtime_error & ) {
+        threw = true;
+    }
+    EXPECT_TRUE( threw );
+    remove( filepath.c_str() );
+
+    threw = false;
+    std::vector< int64_t > one( 1 );
+    std::vector< int64_t > two( 2 );
+    try {
+        ColumnarWriter().addColumn( "a", one ).addColumn( "b", two ).write( filepath );
+    } catch( std::runtime_error & ) {
+        threw = true;
+    }
+    EXPECT_TRUE( threw );
+}
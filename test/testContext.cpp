@@ -0,0 +1,82 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <iostream>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "test/gtest_supp.h"
+
+#include "Context.h"
+#include "Jinja2CppLight.h"
+
+using namespace std;
+using namespace Jinja2CppLight;
+
+TEST( testContext, getAndSet ) {
+    Context context;
+    EXPECT_EQ( 0, context.get( "a" ) );
+    context.set( "a", 1 ).set( "b", "two" );
+    EXPECT_EQ( 1, context.get( "a" )->asInt() );
+    EXPECT_EQ( "two", context.get( "b" )->asString() );
+    context.set( "a", 3 );
+    EXPECT_EQ( 3, context.get( MapKey( "a" ) )->asInt() );
+    EXPECT_EQ( 1, context.depth() );
+}
+
+TEST( testContext, overlays ) {
+    Context base;
+    base.set( "a", 1 ).set( "b", 2 );
+    Context call = base.overlay();
+    call.set( "b", 20 ).set( "c", 30 );
+    EXPECT_EQ( 2, call.depth() );
+    EXPECT_EQ( 1, call.get( "a" )->asInt() );
+    EXPECT_EQ( 20, call.get( "b" )->asInt() );
+    EXPECT_EQ( 30, call.get( "c" )->asInt() );
+    EXPECT_EQ( 2, base.get( "b" )->asInt() );
+    EXPECT_EQ( 0, base.get( "c" ) );
+
+    // the overlay keeps the base as it was
+    base.set( "a", 100 );
+    EXPECT_EQ( 1, call.get( "a" )->asInt() );
+    EXPECT_EQ( 100, base.get( "a" )->asInt() );
+}
+
+TEST( testContext, snapshots ) {
+    Context original;
+    original.set( "a", 1 );
+    Context snapshot = original;
+    EXPECT_EQ( original.get( "a" ), snapshot.get( "a" ) ); // shared, not copied
+    snapshot.set( "a", 2 );
+    original.set( "b", 3 );
+    EXPECT_EQ( 1, original.get( "a" )->asInt() );
+    EXPECT_EQ( 2, snapshot.get( "a" )->asInt() );
+    EXPECT_EQ( 0, snapshot.get( "b" ) );
+}
+
+TEST( testContext, render ) {
+    Context device;
+    device.set( "warpSize", 32 ).set( "name", "gpu" );
+    Context call = device.overlay();
+    call.set( "n", 3 );
+    Template mytemplate( "{{name}} {{warpSize}}{% for i in range(n) %} {{i}}{% endfor %} {{local}}" );
+    mytemplate.setValue( "local", "x" );
+    EXPECT_EQ( "gpu 32 0 1 2 x", mytemplate.render( call ) );
+
+    // the template's own values win over the context
+    mytemplate.setValue( "warpSize", 64 );
+    EXPECT_EQ( "gpu 64 0 1 2 x", mytemplate.render( call ) );
+
+    Template other( "{{n}}" );
+    bool threw = false;
+    try {
+        other.render( device );
+    } catch( render_error &e ) {
+        EXPECT_EQ( std::string( "name n not defined" ), e.what() );
+        threw = true;
+    }
+    EXPECT_TRUE( threw );
+}
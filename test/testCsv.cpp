@@ -0,0 +1,80 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <cstdio>
+
+#include "gtest/gtest.h"
+#include "test/gtest_supp.h"
+
+#include "Csv.h"
+#include "Jinja2CppLight.h"
+
+using namespace std;
+using namespace Jinja2CppLight;
+
+namespace {
+void writeFile( const std::string &filepath, const std::string &contents ) {
+    std::ofstream out( filepath.c_str(), std::ios::binary );
+    out << contents;
+}
+}
+
+TEST( testCsv, columns ) {
+    const std::string filepath = "jinja2cpplight_test_columns.csv";
+    writeFile( filepath, "item,\"unit price\",qty\r\n" );
+    CsvTable table( filepath );
+    remove( filepath.c_str() );
+    EXPECT_EQ( 3, table.numColumns() );
+    EXPECT_EQ( "unit price", table.columnName( 1 ) );
+    EXPECT_EQ( 2, table.findColumn( "qty" ) );
+    EXPECT_EQ( -1, table.findColumn( "price" ) );
+    EXPECT_EQ( "{}", table.rows().render() );
+}
+
+TEST( testCsv, renderRows ) {
+    const std::string filepath = "jinja2cpplight_test_renderRows.csv";
+    writeFile( filepath,
+        "item,price,note\n"
+        "apple,1.5,fresh\n"
+        "\"pear, green\",2,\"says \"\"hi\"\"\"\r\n"
+        "\n"
+        "\"multi\nline\",3\n"
+        "plum,0.25,last" );
+    Template mytemplate( "{% for row in sales %}{{row.item}}={{row.price}} [{{row.note}}];{% endfor %}" );
+    {
+        CsvTable table( filepath );
+        mytemplate.setValue( "sales", table.rows() );
+    }
+    remove( filepath.c_str() );
+    const std::string expected = "apple=1.5 [fresh];pear, green=2 [says \"hi\"];multi\nline=3 [];plum=0.25 [last];";
+    EXPECT_EQ( expected, mytemplate.render() );
+    EXPECT_EQ( expected, mytemplate.render() );
+
+    Template whole( "{% for row in sales %}{{row}}{% endfor %}" );
+    writeFile( filepath, "a;b\n1;2\n" );
+    whole.setValue( "sales", CsvTable( filepath, ';' ).rows() );
+    remove( filepath.c_str() );
+    EXPECT_EQ( "{a: 1, b: 2}", whole.render() );
+}
+
+TEST( testCsv, missingColumn ) {
+    const std::string filepath = "jinja2cpplight_test_missingColumn.csv";
+    writeFile( filepath, "a\n1\n" );
+    Template mytemplate( "{% for row in rows %}{{row.b}}{% endfor %}" );
+    mytemplate.setValue( "rows", CsvTable( filepath ).rows() );
+    remove( filepath.c_str() );
+    bool threw = false;
+    try {
+        mytemplate.render();
+    } catch( render_error &e ) {
+        EXPECT_EQ( std::string( "name row.b not defined" ), e.what() );
+        threw = true;
+    }
+    EXPECT_TRUE( threw );
+}
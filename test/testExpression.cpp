@@ -0,0 +1,129 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <iostream>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "test/gtest_supp.h"
+
+#include "Expression.h"
+#include "Jinja2CppLight.h"
+
+using namespace std;
+using namespace Jinja2CppLight;
+
+namespace {
+    string renderError( const string &source ) {
+        try {
+            Template mytemplate( source );
+            mytemplate.render();
+        } catch( render_error &e ) {
+            return e.what();
+        }
+        return "";
+    }
+}
+
+TEST( testExpression, arithmetic ) {
+    Template mytemplate( "{{ 1 + 2 * 3 }}|{{ (1 + 2) * 3 }}|{{ 7 / 2 }}|{{ 7 // 2 }}|{{ -7 // 2 }}|{{ -7 % 3 }}|"
+        "{{ 7 % -3 }}|{{ 2.5 * 2 }}|{{ -n + 1 }}|{{ n - -1 }}|{{ 5.5 // 2 }}|{{ -5.5 % 2 }}" );
+    mytemplate.setValue( "n", 4 );
+    EXPECT_EQ( "7|9|3.5|3|-4|2|-2|5|-3|5|2|0.5", mytemplate.render() );
+
+    // only a lone constant is negated at compile time
+    Template chains( "{{ -(a or 1) }}|{{ 2 * -(x or 1) }}|{{ -(a and 2) }}|{{ -(missing or 1) }}|{{ --3 }}|{{ -(2.5) }}" );
+    chains.setValue( "a", 5 );
+    chains.setValue( "x", 4 );
+    EXPECT_EQ( "-5|-8|-2|-1|3|-2.5", chains.render() );
+}
+
+TEST( testExpression, loopIndex ) {
+    Template mytemplate( "{% for i in range(3) %}a[{{ i * 4 + 1 }}] = image[{{ i+offset }}];{% endfor %}" );
+    mytemplate.setValue( "offset", 10 );
+    EXPECT_EQ( "a[1] = image[10];a[5] = image[11];a[9] = image[12];", mytemplate.render() );
+}
+
+TEST( testExpression, strings ) {
+    Template mytemplate( "{{ 'ab' + \"cd\" }}|{{ prefix + '_' + name }}|{{ 'x' + long + long }}|{{ 'it\\'s' }}" );
+    mytemplate.setValue( "prefix", "kernel" );
+    mytemplate.setValue( "name", "conv" );
+    mytemplate.setValue( "long", "0123456789abcdef" );
+    EXPECT_EQ( "abcd|kernel_conv|x0123456789abcdef0123456789abcdef|it's", mytemplate.render() );
+}
+
+TEST( testExpression, comparisons ) {
+    Template mytemplate( "{{ n > 8 }}{{ n >= 9 }}{{ n < 9 }}{{ n <= 8 }}{{ n == 9 }}{{ n != 9 }}|"
+        "{{ 2 < 2.5 }}{{ 'abc' < 'abd' }}{{ 'ab' < 'a' }}{{ name == 'conv' }}{{ missing == None }}{{ n == 'x' }}" );
+    mytemplate.setValue( "n", 9 );
+    mytemplate.setValue( "name", "conv" );
+    EXPECT_EQ( "TrueTrueFalseFalseTrueFalse|TrueTrueFalseTrueTrueFalse", mytemplate.render() );
+}
+
+TEST( testExpression, booleans ) {
+    Template mytemplate( "{% if n > 8 and vec %}a{% endif %}{% if n > 8 and not vec %}b{% endif %}"
+        "{% if missing or n %}c{% endif %}{% if not (n < 3 or vec) %}d{% endif %}"
+        "{% if missing and missing.x > 2 %}e{% endif %}|{{ vec or 'none' }}|{{ n and 'yes' }}|{{ True }}{{ not 0 }}" );
+    mytemplate.setValue( "n", 9 );
+    mytemplate.setValue( "vec", 0 );
+    EXPECT_EQ( "bcd|none|yes|TrueTrue", mytemplate.render() );
+
+    // comparisons, not and the literals give booleans, which print as True
+    // and False but still count as 1 and 0; and / or pass an operand through
+    Template printed( "{{ 1 < 2 }}|{{ not x }}|{{ True }}|{{ False }}|"
+        "{% for i in range(3) %}{{ loop.first }}{{ not loop.first }}{% endfor %}|{{ True + 1 }}|{{ (1 < 2) == 1 }}|"
+        "{{ x or False }}|{{ False or x }}|{{ x and True }}" );
+    printed.setValue( "x", 0 );
+    EXPECT_EQ( "True|True|True|False|TrueFalseFalseTrueFalseTrue|2|True|False|0|0", printed.render() );
+}
+
+TEST( testExpression, indexing ) {
+    MapValue tile;
+    tile.set( "x", 16 ).set( "y", 8 );
+    MapValue cfg;
+    cfg.set( "tile", tile ).set( "name", "conv" );
+    std::vector< int > image = { 10, 11, 12, 13 };
+    Template mytemplate( "{% for i in range(3) %}{{ image[i + 1] }},{% endfor %}|{{ image[-1] }}|{{ cfg.tile.x // 2 }}|"
+        "{{ cfg['tile'].y }}|{{ cfg[key].x }}|{{ rows[1][0] }}|{{ (rows[0])[1] * 2 }}|{{ image[9] == None }}" );
+    mytemplate.setValue( "image", image );
+    mytemplate.setValue( "cfg", cfg );
+    mytemplate.setValue( "key", "tile" );
+    mytemplate.setValue( "rows", TupleValue::create( TupleValue::create( 1, 2 ), TupleValue::create( 3, 4 ) ) );
+    EXPECT_EQ( "11,12,13,|13|8|8|16|3|4|True", mytemplate.render() );
+}
+
+TEST( testExpression, compiledOnce ) {
+    // a plain name stays a plain name, everything else is compiled, with
+    // names and constant paths resolved up front
+    Template mytemplate( "" );
+    LoopScope scope;
+    scope.push( "i" );
+    Expression plain;
+    plain.compile( "cfg.tile.x", mytemplate, scope );
+    EXPECT_TRUE( plain.isVariable() );
+    EXPECT_EQ( 2u, plain.variables[0].path.size() );
+
+    Expression computed;
+    computed.compile( "i * 4 + cfg.tile['x']", mytemplate, scope );
+    EXPECT_FALSE( computed.isVariable() );
+    EXPECT_EQ( 2u, computed.variables.size() );
+    EXPECT_EQ( 0, computed.variables[0].frame );
+    EXPECT_EQ( 2u, computed.variables[1].path.size() );
+    EXPECT_EQ( 5u, computed.code.size() );
+    EXPECT_EQ( 2, computed.stackSize );
+}
+
+TEST( testExpression, errors ) {
+    EXPECT_EQ( "division by zero in 1 // n", renderError( "{% for n in range(1) %}{{ 1 // n }}{% endfor %}" ) );
+    EXPECT_EQ( "cannot apply + to int and string in 1 + 'a'", renderError( "{{ 1 + 'a' }}" ) );
+    EXPECT_EQ( "cannot apply * to None and int in missing * 2", renderError( "{{ missing * 2 }}" ) );
+    EXPECT_EQ( "cannot compare int and string in 1 < 'a'", renderError( "{{ 1 < 'a' }}" ) );
+    EXPECT_EQ( "missing ) in (1 + 2", renderError( "{{ (1 + 2 }}" ) );
+    EXPECT_EQ( "unexpected 3 in 1 + 2 3", renderError( "{{ 1 + 2 3 }}" ) );
+    EXPECT_EQ( "expression expected in 1 +", renderError( "{{ 1 + }}" ) );
+    EXPECT_EQ( "unterminated string in 'abc", renderError( "{{ 'abc }}" ) );
+    EXPECT_EQ( "name missing not defined", renderError( "{{ missing }}" ) );
+}
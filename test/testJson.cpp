@@ -0,0 +1,89 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <cstdio>
+
+#include "gtest/gtest.h"
+#include "test/gtest_supp.h"
+
+#include "Json.h"
+#include "Jinja2CppLight.h"
+
+using namespace std;
+using namespace Jinja2CppLight;
+
+TEST( testJson, values ) {
+    EXPECT_EQ( 42, parseJson( "42" ).asInt() );
+    EXPECT_EQ( -7, parseJson( " -7 " ).asInt() );
+    EXPECT_EQ( 1.5, parseJson( "1.5" ).asFloat() );
+    EXPECT_EQ( 1e20, parseJson( "1e20" ).asFloat() );
+    EXPECT_EQ( Value::FLOAT, parseJson( "12345678901234567890" ).type() );
+    EXPECT_EQ( 123456789012345678901.0, parseJson( "123456789012345678901" ).asFloat() );
+    EXPECT_EQ( -99999999999999999999999999.0, parseJson( "-99999999999999999999999999" ).asFloat() );
+    EXPECT_EQ( 999999999999999999LL, parseJson( "999999999999999999" ).asInt() );
+    EXPECT_EQ( 1, parseJson( "true" ).asInt() );
+    EXPECT_EQ( 0, parseJson( "false" ).asInt() );
+    EXPECT_EQ( "True", parseJson( "true" ).render() );
+    EXPECT_EQ( "{False, 0, 1}", parseJson( "[false, 0, 1]" ).render() );
+    EXPECT_TRUE( parseJson( "false" ).isBool() );
+    EXPECT_FALSE( parseJson( "0" ).isBool() );
+    EXPECT_EQ( Value::NONE, parseJson( "null" ).type() );
+    EXPECT_EQ( "abc", parseJson( "\"abc\"" ).asString() );
+    EXPECT_EQ( "a\"b\\c\nd\xc3\xa9\xf0\x9f\x98\x80", parseJson( "\"a\\\"b\\\\c\\nd\\u00e9\\ud83d\\ude00\"" ).asString() );
+    EXPECT_EQ( "{1, {}, {a: x, b: {c: 2.5}}}", parseJson( "[1, [], {\"a\": \"x\", \"b\": {\"c\": 2.5}}]" ).render() );
+}
+
+TEST( testJson, stringsReferenceInput ) {
+    std::string longString( 100, 'x' );
+    std::shared_ptr< const std::string > text = std::make_shared< const std::string >( "[\"" + longString + "\"]" );
+    Value parsed = parseJson( text->data(), text->size(), text );
+    Value scratch;
+    const Value *element = parsed.asSequence().at( 0, scratch );
+    EXPECT_EQ( longString, element->asString() );
+    EXPECT_EQ( text->data() + 2, element->stringData() );
+}
+
+TEST( testJson, errors ) {
+    const char *invalid[] = { "", "[1,", "{\"a\" 1}", "\"abc", "01", "1.", "tru", "[1] x", "{1: 2}", "\"\\x\"" };
+    for( size_t i = 0; i < sizeof( invalid ) / sizeof( invalid[0] ); i++ ) {
+        bool threw = false;
+        try {
+            parseJson( invalid[i] );
+        } catch( json_error & ) {
+            threw = true;
+        }
+        EXPECT_TRUE( threw ) << invalid[i];
+    }
+    try {
+        parseJson( "{\n\"a\": [1,\n 2,, 3]}" );
+        FAIL();
+    } catch( json_error &e ) {
+        EXPECT_EQ( std::string( "json: unexpected character at line 3" ), e.what() );
+    }
+}
+
+TEST( testJson, loadContext ) {
+    const std::string filepath = "jinja2cpplight_test_context.json";
+    {
+        std::ofstream out( filepath.c_str() );
+        out << "{ \"dtype\": \"float\", \"dims\": [3, 5], \"tile\": { \"x\": 16 }, \"debug\": false }";
+    }
+    Context context = loadJsonContext( filepath );
+    remove( filepath.c_str() );
+    Template mytemplate( "{{dtype}} {{tile.x}}{% for d in dims %} {{d}}{% endfor %}{% if debug %} debug{% endif %}" );
+    EXPECT_EQ( "float 16 3 5", mytemplate.render( context ) );
+
+    bool threw = false;
+    try {
+        jsonContext( parseJson( "[1]" ) );
+    } catch( json_error & ) {
+        threw = true;
+    }
+    EXPECT_TRUE( threw );
+}
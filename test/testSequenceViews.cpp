@@ -0,0 +1,85 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <iostream>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "test/gtest_supp.h"
+
+#include "SequenceViews.h"
+
+using namespace std;
+using namespace Jinja2CppLight;
+
+namespace {
+Value counter( int count ) {
+    return Value( GeneratorValue( [count]() {
+        int i = 0;
+        return GeneratorValue::Generator( [i, count]( Value &next ) mutable {
+            next.setInt( i );
+            return i++ < count;
+        } );
+    } ) );
+}
+}
+
+TEST( testSequenceViews, slices ) {
+    Value items( TupleValue::create( 0, 1, 2, 3, 4 ) );
+    EXPECT_EQ( "{1, 2, 3, 4}", sliceView( items, 1, SLICE_DEFAULT, SLICE_DEFAULT ).render() );
+    EXPECT_EQ( "{0, 1, 2}", sliceView( items, SLICE_DEFAULT, -2, SLICE_DEFAULT ).render() );
+    EXPECT_EQ( "{0, 2, 4}", sliceView( items, SLICE_DEFAULT, SLICE_DEFAULT, 2 ).render() );
+    EXPECT_EQ( "{4, 2, 0}", sliceView( items, SLICE_DEFAULT, SLICE_DEFAULT, -2 ).render() );
+    EXPECT_EQ( "{3, 2}", sliceView( items, 3, 1, -1 ).render() );
+    EXPECT_EQ( "{}", sliceView( items, 4, 1, 1 ).render() );
+    EXPECT_EQ( "{0, 1, 2, 3, 4}", sliceView( items, -100, 100, 1 ).render() );
+    EXPECT_EQ( "{4, 3, 2, 1, 0}", reversedView( items ).render() );
+    EXPECT_EQ( "{1, 3}", sliceView( counter( 5 ), 1, SLICE_DEFAULT, 2 ).render() );
+    EXPECT_EQ( "{0, 1}", sliceView( counter( 5 ), SLICE_DEFAULT, 2, SLICE_DEFAULT ).render() );
+
+    bool threw = false;
+    try {
+        sliceView( items, 0, 1, 0 );
+    } catch( render_error & ) {
+        threw = true;
+    }
+    EXPECT_TRUE( threw );
+    threw = false;
+    try {
+        reversedView( counter( 5 ) );
+    } catch( render_error & ) {
+        threw = true;
+    }
+    EXPECT_TRUE( threw );
+}
+
+TEST( testSequenceViews, enumerateAndZip ) {
+    Value letters( TupleValue::create( "a", "b", "c" ) );
+    Value numbers( TupleValue::create( 1, 2 ) );
+    EXPECT_EQ( "{{0, a}, {1, b}, {2, c}}", enumerateView( letters ).render() );
+    EXPECT_EQ( "{{5, 0}, {6, 1}}", enumerateView( counter( 2 ), 5 ).render() );
+    std::vector< Value > bases;
+    bases.push_back( letters );
+    bases.push_back( numbers );
+    EXPECT_EQ( "{{a, 1}, {b, 2}}", zipView( bases ).render() );
+    bases.push_back( counter( 10 ) );
+    EXPECT_EQ( "{{a, 1, 0}, {b, 2, 1}}", zipView( bases ).render() );
+}
+
+TEST( testSequenceViews, rangeLength ) {
+    EXPECT_EQ( 5u, rangeLength( 0, 5, 1 ) );
+    EXPECT_EQ( 4u, rangeLength( 0, 10, 3 ) );
+    EXPECT_EQ( 3u, rangeLength( 5, -1, -2 ) );
+    EXPECT_EQ( 0u, rangeLength( 5, 5, 1 ) );
+    EXPECT_EQ( 0u, rangeLength( 5, 0, 1 ) );
+    EXPECT_EQ( 0u, rangeLength( 0, 5, -1 ) );
+    // bounds whose difference doesn't fit in an int64_t
+    const int64_t big = (int64_t)1 << 62;
+    EXPECT_EQ( 3074457345618258603u, rangeLength( -big, big, 3 ) );
+    EXPECT_EQ( 3074457345618258603u, rangeLength( big, -big, -3 ) );
+    EXPECT_EQ( 18446744073709551615u, rangeLength( INT64_MIN, INT64_MAX, 1 ) );
+    EXPECT_EQ( 2u, rangeLength( INT64_MAX, INT64_MIN, INT64_MIN ) ); // INT64_MAX, -1
+}
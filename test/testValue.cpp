@@ -0,0 +1,133 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <iostream>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "test/gtest_supp.h"
+
+#include "Value.h"
+
+using namespace std;
+using namespace Jinja2CppLight;
+
+TEST( testValue, types ) {
+    EXPECT_EQ( Value::NONE, Value().type() );
+    EXPECT_EQ( Value::INT, Value( 3 ).type() );
+    EXPECT_EQ( Value::FLOAT, Value( 3.5 ).type() );
+    EXPECT_EQ( Value::STRING, Value( "abc" ).type() );
+    EXPECT_EQ( Value::SEQUENCE, Value( TupleValue::create( 1, 2 ) ).type() );
+    EXPECT_EQ( Value::MAP, Value( MapValue().set( "a", 1 ) ).type() );
+}
+
+TEST( testValue, render ) {
+    EXPECT_EQ( "-1234567890123", Value( -1234567890123LL ).render() );
+    EXPECT_EQ( "0", Value( 0 ).render() );
+    EXPECT_EQ( "12.123", Value( 12.123f ).render() );
+    EXPECT_EQ( "1.1", Value( 1.1 ).render() );
+    EXPECT_EQ( "None", Value().render() );
+    EXPECT_EQ( "{1, 2.5, abc, {}}", Value( TupleValue::create( 1, 2.5, "abc", TupleValue() ) ).render() );
+    EXPECT_EQ( "{a: 1, b: x}", Value( MapValue().set( "a", 1 ).set( "b", "x" ) ).render() );
+}
+
+TEST( testValue, doublesKeepPrecision ) {
+    TupleValue tuple = TupleValue::create( 0.1 );
+    EXPECT_EQ( 0.1, tuple.values[0].asFloat() );
+}
+
+TEST( testValue, strings ) {
+    string shortString = "short";
+    string longString( 1000, 'x' );
+    Value shortValue( shortString );
+    Value longValue( longString );
+    EXPECT_EQ( shortString, shortValue.asString() );
+    EXPECT_EQ( longString, longValue.asString() );
+
+    // copies share the long string's buffer
+    Value copy = longValue;
+    EXPECT_EQ( longValue.stringData(), copy.stringData() );
+
+    copy.setInt( 7 );
+    EXPECT_EQ( "7", copy.render() );
+    EXPECT_EQ( longString, longValue.render() );
+}
+
+TEST( testValue, isTrue ) {
+    EXPECT_FALSE( Value().isTrue() );
+    EXPECT_FALSE( Value( 0 ).isTrue() );
+    EXPECT_TRUE( Value( 2 ).isTrue() );
+    EXPECT_FALSE( Value( 0.0 ).isTrue() );
+    EXPECT_FALSE( Value( "" ).isTrue() );
+    EXPECT_TRUE( Value( "a" ).isTrue() );
+    EXPECT_FALSE( Value( TupleValue() ).isTrue() );
+    EXPECT_TRUE( Value( TupleValue::create( 0 ) ).isTrue() );
+    EXPECT_FALSE( Value( MapValue() ).isTrue() );
+}
+
+TEST( testValue, mapValue ) {
+    MapValue map;
+    map.set( "a", 1 ).set( "b", 2 ).set( "a", 3 );
+    EXPECT_EQ( 2u, map.size() );
+    EXPECT_EQ( 3, map.get( "a" )->asInt() );
+    EXPECT_TRUE( map.get( "c" ) == 0 );
+}
+
+TEST( testValue, borrowedStrings ) {
+    string fragment( 20000, 'k' );
+    Value borrowed = Value::borrow( fragment );
+    EXPECT_EQ( fragment.data(), borrowed.stringData() );
+    EXPECT_EQ( fragment.size(), borrowed.stringLength() );
+
+    // copies keep pointing at the caller's characters
+    TupleValue tuple;
+    tuple.addValue( borrowed );
+    EXPECT_EQ( fragment.data(), tuple.values[0].stringData() );
+
+    std::shared_ptr< const string > buffer = std::make_shared< const string >( 30000, 'b' );
+    Value shared( buffer );
+    EXPECT_EQ( buffer->data(), shared.stringData() );
+    EXPECT_EQ( 2, buffer.use_count() );
+    Value partOfBuffer = Value::shared( buffer->data() + 100, 5, buffer );
+    EXPECT_EQ( "bbbbb", partOfBuffer.render() );
+}
+
+TEST( testValue, mapValueIndex ) {
+    MapValue map;
+    for( int i = 0; i < 1000; i++ ) {
+        map.set( "key" + toString( i ), i );
+    }
+    Value scratch;
+    for( int i = 0; i < 1000; i += 37 ) {
+        MapKey key( "key" + toString( i ) );
+        EXPECT_EQ( i, map.get( key, scratch )->asInt() );
+        EXPECT_EQ( (size_t)i, key.hint.load() );
+        EXPECT_EQ( i, map.get( key, scratch )->asInt() );
+    }
+    EXPECT_TRUE( map.get( MapKey( "nokey" ), scratch ) == 0 );
+}
+
+TEST( testValue, generators ) {
+    Value squares( GeneratorValue( []() {
+        int i = 0;
+        return GeneratorValue::Generator( [i]( Value &next ) mutable {
+            next.setInt( i * i );
+            return ++i <= 4;
+        } );
+    } ) );
+    EXPECT_EQ( Value::ITERABLE, squares.type() );
+    EXPECT_EQ( "{0, 1, 4, 9}", squares.render() );
+    EXPECT_EQ( "{0, 1, 4, 9}", squares.render() ); // starts again from the beginning
+    EXPECT_TRUE( squares.isTrue() );
+
+    Value empty( GeneratorValue( []() {
+        return GeneratorValue::Generator( []( Value & ) {
+            return false;
+        } );
+    } ) );
+    EXPECT_EQ( "{}", empty.render() );
+    EXPECT_FALSE( empty.isTrue() );
+}
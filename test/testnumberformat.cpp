@@ -0,0 +1,75 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <limits>
+
+#include "numberformat.h"
+#include "Output.h"
+#include "stringhelper.h"
+
+#include "gtest/gtest.h"
+#include "test/gtest_supp.h"
+
+using namespace std;
+using namespace Jinja2CppLight;
+
+namespace {
+    string formatted( int64_t value ) {
+        char buffer[MAX_NUMBER_LENGTH];
+        return string( buffer, formatInt( value, buffer ) );
+    }
+    string formatted( double value ) {
+        char buffer[MAX_NUMBER_LENGTH];
+        return string( buffer, formatDouble( value, buffer ) );
+    }
+}
+
+TEST( testnumberformat, decimalCounter ) {
+    int64_t starts[] = { 0, 7, 98, 999, 123456789, 9999999999LL };
+    for( size_t i = 0; i < sizeof( starts ) / sizeof( starts[0] ); i++ ) {
+        DecimalCounter counter( starts[i] );
+        for( int64_t value = starts[i]; value < starts[i] + 1200; value++ ) {
+            ASSERT_EQ( toString( value ), string( counter.data(), counter.size() ) );
+            counter.increment();
+        }
+    }
+}
+
+TEST( testnumberformat, ints ) {
+    int64_t values[] = { 0, 1, -1, 9, 10, 99, 100, 12345, -98765, 1000000007,
+        std::numeric_limits<int64_t>::max(), std::numeric_limits<int64_t>::min() };
+    for( size_t i = 0; i < sizeof( values ) / sizeof( values[0] ); i++ ) {
+        EXPECT_EQ( toString( values[i] ), formatted( values[i] ) );
+    }
+}
+
+TEST( testnumberformat, doublesMatchOstream ) {
+    double values[] = { 0.0, -0.0, 1.0, -3.0, 0.5, 1.1, 20.256, 12.123f, 999999.0, 1000000.0,
+        1e-7, 123456789.0, -2.5e10, 1.0 / 3.0, std::numeric_limits<double>::infinity() };
+    for( size_t i = 0; i < sizeof( values ) / sizeof( values[0] ); i++ ) {
+        EXPECT_EQ( toString( values[i] ), formatted( values[i] ) );
+    }
+}
+
+TEST( testnumberformat, batches ) {
+    vector< float > weights;
+    string expected = "{";
+    for( int i = 0; i < 1000; i++ ) {
+        weights.push_back( i * 0.25f - 10 );
+        expected += ( i > 0 ? ", " : "" ) + toString( weights.back() );
+    }
+    expected += "}";
+    StringOutput output;
+    formatNumbers( &weights[0], weights.size(), output );
+    EXPECT_EQ( expected, output.release() );
+
+    StringOutput empty;
+    formatNumbers( (const int *)0, 0, empty );
+    EXPECT_EQ( "{}", empty.release() );
+}